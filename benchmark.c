@@ -0,0 +1,586 @@
+/* This program measures how quickly the different queue modes of the
+thread pool accept and hand out tasks when the queue is very deep.
+
+For each mode a pool is created with no threads and 'number_tasks'
+empty tasks with random priorities are added, so every push lands in
+an ever deeper queue. A single thread is then added and the pool is
+destroyed when idle, which times how long that thread takes to pull
+every task back out.
+
+The heaps are run twice: once ordering tasks with a comparison
+function and once created without one, so the integer priority given
+to add_task_with_priority is compared inline instead. The Fibonacci 
+Heap is also run at depths growing tenfold up to 'number_tasks', which
+shows its pulls only get logarithmically slower as the queue deepens.
+
+Then a loop of 'number_tasks' iterations is split across a pool of 
+four threads, once by adding a task per chunk of 64 iterations and 
+waiting with pool_wait_idle, and once with pool_parallel_for.
+
+Last an array of 'number_tasks' integers is sorted with a recursive 
+quicksort that splits with pool_spawn and pool_sync, on a FIFO Queue 
+and on LIFO Work Stealing Deques, and without a pool for comparison.
+
+Compile with:
+
+$ gcc -O2 -pthread thread_pool.c benchmark.c -o benchmark
+
+adding -mavx2 lets the 8-ary Heap compare all eight children at once.
+
+and run with the number of tasks as an optional argument:
+
+$ ./benchmark 1000000
+
+With --json a suite of workloads is run on every queue mode instead 
+and each run is printed as one line of JSON, so results can be kept 
+and compared between versions:
+
+$ ./benchmark 1000000 --json > results.jsonl
+
+The workloads are:
+
+microtasks  one thread adds empty tasks to a pool of four threads
+skewed      tasks doing a little work, nine in ten of them in the 
+            lowest eighth of the priorities
+bursty      bursts of 1000 tasks with a millisecond pause in between,
+            so the threads keep going to sleep and being woken
+deep        every task is added before a single thread drains the pool
+mpmc        four threads add tasks to a pool of four threads at once
+
+Each line gives the throughput, the 50th, 99th and 99.9th percentile
+of the time add_task took ('push') and of the time tasks waited in 
+the queue before a thread took them ('wait'), how often and for how
+long threads waited for the pool's lock, how long they held it, and 
+the peak resident memory of the process so far. The skewed workload
+also gives the wait of the low and high priority tasks separately. 
+The Ring Buffer is left out of 'deep' since it is bounded and once 
+full the adding thread runs the oldest task, so the queue never gets
+deeper.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "thread_pool.h"
+
+
+//the priority of each task
+struct priority_info{
+
+  int priority;
+};
+
+
+/*
+  If first argument is of greater priority return greater or equal
+  to 0.
+  If second argument is of greater priority return less than 0.
+*/
+int compare(const void* p1, const void* p2){
+
+  struct priority_info* s1 = (struct priority_info*)p1;
+  struct priority_info* s2 = (struct priority_info*)p2;
+
+  return (s1->priority > s2->priority) - (s1->priority < s2->priority);
+}
+
+
+//The tasks do no work so only the cost of the queue is measured
+void empty_task(void* arg){
+
+  (void)arg;
+  return;
+}
+
+
+//Returns seconds elapsed since 'start'
+double seconds_since(struct timespec* start){
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec)/1e9;
+}
+
+
+//Each iteration of the loop adds to the element of the array
+struct loop_chunk{
+
+  double* values;
+  long begin;
+  long end;
+};
+
+void loop_body(long begin, long end, void* ctx){
+
+  double* values = (double*)ctx;
+  for(long i=begin; i<end; i++){
+    values[i] = values[i]*1.000001 + 1.0;
+  }
+  return;
+}
+
+void loop_task(void* arg){
+
+  struct loop_chunk* chunk = (struct loop_chunk*)arg;
+  loop_body(chunk->begin, chunk->end, chunk->values);
+  return;
+}
+
+
+/*
+  Runs the loop of 'number_iterations' iterations first with a task per
+  chunk and then with pool_parallel_for.
+*/
+void loop_benchmark(long number_iterations){
+
+  struct timespec start;
+  long number_chunks = (number_iterations+63)/64;
+  double* values = calloc(number_iterations, sizeof(double));
+  struct loop_chunk* chunks = malloc(number_chunks*sizeof(struct loop_chunk));
+  struct thread_pool* pool = create_pool(4, 4, NULL);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(long i=0; i<number_chunks; i++){
+    chunks[i].values = values;
+    chunks[i].begin = i*64;
+    chunks[i].end = (i*64+64 < number_iterations) ? i*64+64 : number_iterations;
+    add_task(pool, loop_task, (void*)(&chunks[i]));
+  }
+  pool_wait_idle(pool);
+  printf("%-24s %8.3f s\n", "task per chunk", seconds_since(&start));
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pool_parallel_for(pool, 0, number_iterations, 0, loop_body, values);
+  printf("%-24s %8.3f s\n", "pool_parallel_for", seconds_since(&start));
+
+  destroy_pool_when_idle(pool);
+  free(chunks);
+  free(values);
+  return;
+}
+
+
+//Subarrays shorter than this are sorted without splitting further
+#define SORT_CUTOFF 2048
+
+struct sort_range{
+
+  int* v;
+  long left;
+  long right;
+};
+
+//NULL sorts without the pool
+struct thread_pool* sort_pool = NULL;
+
+int compare_int(const void* p1, const void* p2){
+
+  int a = *(const int*)p1;
+  int b = *(const int*)p2;
+  return (a > b) - (a < b);
+}
+
+/*
+  Sorts v[left..right]. The left part of each partition is spawned as a
+  child and the right part sorted by the same task.
+*/
+void quick_sort(void* arg){
+
+  struct sort_range* range = (struct sort_range*)arg;
+  int* v = range->v;
+  long left = range->left;
+  long right = range->right;
+
+  while(right-left+1 > SORT_CUTOFF){
+
+    int pivot = v[left + (right-left)/2];
+    long i = left;
+    long j = right;
+
+    while(i <= j){
+      while(v[i] < pivot){
+	i++;
+      }
+      while(v[j] > pivot){
+	j--;
+      }
+      if(i <= j){
+	int temp = v[i];
+	v[i] = v[j];
+	v[j] = temp;
+	i++;
+	j--;
+      }
+    }
+
+    struct sort_range child = {v, left, j};
+    if(sort_pool != NULL){
+      pool_spawn(sort_pool, quick_sort, (void*)(&child));
+    }
+    else{
+      quick_sort((void*)(&child));
+    }
+
+    //the child lives on this stack so it is waited for before moving on
+    left = i;
+    if(sort_pool != NULL){
+      struct sort_range rest = {v, left, right};
+      quick_sort((void*)(&rest));
+      pool_sync(sort_pool);
+      return;
+    }
+  }
+
+  qsort(v+left, right-left+1, sizeof(int), compare_int);
+  return;
+}
+
+
+/*
+  Sorts a copy of 'values' with a pool of four threads of the given
+  mode, or without a pool if 'mode' is 0.
+*/
+void recursive_sort(int mode, const char* name, int* values, long length){
+
+  struct timespec start;
+  int* v = malloc(length*sizeof(int));
+  memcpy(v, values, length*sizeof(int));
+
+  sort_pool = (mode > 0) ? create_pool(4, mode, NULL) : NULL;
+
+  struct sort_range all = {v, 0, length-1};
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if(sort_pool != NULL){
+    pool_spawn(sort_pool, quick_sort, (void*)(&all));
+    pool_sync(sort_pool);
+  }
+  else{
+    quick_sort((void*)(&all));
+  }
+  double elapsed = seconds_since(&start);
+
+  for(long i=1; i<length; i++){
+    if(v[i-1] > v[i]){
+      printf("ERROR: array is not sorted\n");
+      break;
+    }
+  }
+
+  printf("%-24s %8.3f s\n", name, elapsed);
+
+  if(sort_pool != NULL){
+    destroy_pool_when_idle(sort_pool);
+  }
+  free(v);
+  return;
+}
+
+
+/*
+  Fills a pool of the given mode with 'number_tasks' tasks and then
+  drains it with one thread. Prints the time per push and per pull.
+  'function' is the comparison function the pool is created with.
+*/
+void deep_queue(int mode, const char* name, int (*function)(const void* p1, const void* p2),
+		struct priority_info* info, int number_tasks){
+
+  struct timespec start;
+  double push_time;
+  double pull_time;
+
+  struct thread_pool* pool = create_pool(0, mode, function);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(int i=0; i<number_tasks; i++){
+    add_task_with_priority(pool, empty_task, (void*)(&info[i]), info[i].priority);
+  }
+  push_time = seconds_since(&start);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  add_threads(1, pool);
+  destroy_pool_when_idle(pool);
+  pull_time = seconds_since(&start);
+
+  printf("%-24s push %8.1f ns/task   pull %8.1f ns/task\n", name,
+	 push_time*1e9/number_tasks, pull_time*1e9/number_tasks);
+  return;
+}
+
+
+//Names of the queue modes, by number
+#define NUMBER_MODES 12
+
+const char* mode_names[NUMBER_MODES+1] = {"", "binary_heap", "binomial_heap",
+					  "fibonacci_heap", "fifo", "lifo",
+					  "ws_fifo", "ws_lifo", "ring_buffer",
+					  "array_heap", "8ary_heap", "bucket_queue",
+					  "lazy_binomial_heap"};
+
+#define SUITE_THREADS 4
+#define BURST_SIZE 1000
+#define BURST_PAUSE_US 1000
+//priorities at or above this are the high priority tasks of 'skewed'
+#define SKEWED_HIGH 128
+
+
+//A few hundred nanoseconds of work so a queue builds up behind it
+void short_task(void* arg){
+
+  (void)arg;
+  volatile int sum = 0;
+  for(int i=0; i<200; i++){
+    sum += i;
+  }
+  return;
+}
+
+
+//Returns nanoseconds of CLOCK_MONOTONIC
+unsigned long now_ns(void){
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (unsigned long)now.tv_sec*1000000000UL + now.tv_nsec;
+}
+
+
+/*
+  One thread adding tasks to the pool. Every call to 
+  add_task_with_priority is timed into 'push_ns'. With a 'burst' the 
+  thread pauses after every 'burst' tasks.
+*/
+struct producer{
+
+  struct thread_pool* pool;
+  void (*function)(void* arg);
+  int* priorities;
+  unsigned long* push_ns;
+  long count;
+  int burst;
+};
+
+void* produce(void* arg){
+
+  struct producer* p = (struct producer*)arg;
+
+  for(long i=0; i<p->count; i++){
+
+    unsigned long start = now_ns();
+    add_task_with_priority(p->pool, p->function, NULL, p->priorities[i]);
+    p->push_ns[i] = now_ns() - start;
+
+    if(p->burst > 0 && (i+1)%p->burst == 0){
+      usleep(BURST_PAUSE_US);
+    }
+  }
+  return NULL;
+}
+
+
+int compare_ulong(const void* p1, const void* p2){
+
+  unsigned long a = *(const unsigned long*)p1;
+  unsigned long b = *(const unsigned long*)p2;
+  return (a > b) - (a < b);
+}
+
+//Returns the given percentile of 'n' sorted values, or 0 if there are none
+unsigned long percentile(unsigned long* sorted, long n, double p){
+
+  if(n <= 0){
+    return 0;
+  }
+
+  long rank = (long)(p*n/100.0);
+  return sorted[(rank < n) ? rank : n-1];
+}
+
+
+/*
+  Runs one workload on a pool of the given mode and prints a line of 
+  JSON. 'producers' threads each add 'count' tasks with the priorities
+  in 'priorities'. A 'deep' run adds every task to a pool with no 
+  threads and then adds one thread to drain it.
+*/
+void run_workload(const char* workload, int mode, void (*function)(void* arg),
+		  int* priorities, long count, int producers, int burst, int deep){
+
+  int threads = deep ? 0 : SUITE_THREADS;
+  struct thread_pool* pool = create_pool(threads, mode, NULL);
+  int64_t bounds[1] = {SKEWED_HIGH};
+  pool_set_latency_classes(pool, bounds, 1);
+
+  long total = count*producers;
+  unsigned long* push_ns = malloc(total*sizeof(unsigned long));
+  struct producer* p = malloc(producers*sizeof(struct producer));
+  pthread_t* ids = malloc(producers*sizeof(pthread_t));
+
+  unsigned long start = now_ns();
+
+  for(int i=0; i<producers; i++){
+    p[i].pool = pool;
+    p[i].function = function;
+    p[i].priorities = priorities + i*count;
+    p[i].push_ns = push_ns + i*count;
+    p[i].count = count;
+    p[i].burst = burst;
+    pthread_create(&ids[i], NULL, produce, (void*)(&p[i]));
+  }
+  for(int i=0; i<producers; i++){
+    pthread_join(ids[i], NULL);
+  }
+
+  if(deep){
+    add_threads(1, pool);
+    threads = 1;
+  }
+  pool_wait_idle(pool);
+
+  double seconds = (now_ns() - start)/1e9;
+
+  struct pool_stats stats;
+  struct pool_latency wait;
+  struct pool_latency low;
+  struct pool_latency high;
+  pool_get_stats(pool, &stats);
+  pool_get_latency(pool, 0, -1, &wait);
+  pool_get_latency(pool, 0, 0, &low);
+  pool_get_latency(pool, 0, 1, &high);
+  destroy_pool_when_idle(pool);
+
+  qsort(push_ns, total, sizeof(unsigned long), compare_ulong);
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  printf("{\"workload\":\"%s\",\"mode\":%d,\"queue\":\"%s\",\"threads\":%d,"
+	 "\"producers\":%d,\"tasks\":%ld,\"seconds\":%.6f,\"tasks_per_sec\":%.0f,"
+	 "\"push_p50_ns\":%lu,\"push_p99_ns\":%lu,\"push_p999_ns\":%lu,"
+	 "\"wait_p50_ns\":%lu,\"wait_p99_ns\":%lu,\"wait_p999_ns\":%lu,\"wait_max_ns\":%lu,"
+	 "\"wait_low_p99_ns\":%lu,\"wait_high_p99_ns\":%lu,"
+	 "\"lock_waits\":%lu,\"lock_wait_ns\":%lu,\"lock_hold_ns\":%lu,\"max_queue_depth\":%lu,"
+	 "\"peak_rss_kb\":%ld}\n",
+	 workload, mode, mode_names[mode], threads, producers, total, seconds, total/seconds,
+	 percentile(push_ns, total, 50), percentile(push_ns, total, 99), percentile(push_ns, total, 99.9),
+	 wait.p50, wait.p99, wait.p999, wait.max, low.p99, high.p99,
+	 stats.lock_waits, stats.lock_wait_ns, stats.lock_hold_ns, stats.max_queue_depth, usage.ru_maxrss);
+  fflush(stdout);
+
+  free(ids);
+  free(p);
+  free(push_ns);
+  return;
+}
+
+
+/*
+  Runs every workload on every queue mode. The priorities are random
+  in 0-255 so the Bucket Queue takes them as they are.
+*/
+void workload_suite(int number_tasks){
+
+  int* uniform = malloc(number_tasks*sizeof(int));
+  int* skewed = malloc(number_tasks*sizeof(int));
+
+  for(int i=0; i<number_tasks; i++){
+    uniform[i] = rand()%256;
+    skewed[i] = (rand()%10 == 0) ? SKEWED_HIGH + rand()%128 : rand()%32;
+  }
+
+  for(int mode=1; mode<=NUMBER_MODES; mode++){
+    run_workload("microtasks", mode, empty_task, uniform, number_tasks, 1, 0, 0);
+  }
+  for(int mode=1; mode<=NUMBER_MODES; mode++){
+    run_workload("skewed", mode, short_task, skewed, number_tasks, 1, 0, 0);
+  }
+  for(int mode=1; mode<=NUMBER_MODES; mode++){
+    run_workload("bursty", mode, short_task, uniform, number_tasks/10, 1, BURST_SIZE, 0);
+  }
+  for(int mode=1; mode<=NUMBER_MODES; mode++){
+    run_workload("mpmc", mode, empty_task, uniform, number_tasks/SUITE_THREADS, SUITE_THREADS, 0, 0);
+  }
+  for(int mode=1; mode<=NUMBER_MODES; mode++){
+    if(mode != 8){
+      run_workload("deep", mode, empty_task, uniform, number_tasks, 1, 0, 1);
+    }
+  }
+
+  free(skewed);
+  free(uniform);
+  return;
+}
+
+
+int main(int argc, char* argv[]){
+
+  int number_tasks = 1000000;
+  if(argc > 1){
+    number_tasks = atoi(argv[1]);
+  }
+
+  srand(time(NULL));
+
+  if(argc > 2 && strcmp(argv[2], "--json") == 0){
+    workload_suite(number_tasks);
+    return 0;
+  }
+
+  struct priority_info* info = malloc(sizeof(struct priority_info)*number_tasks);
+  for(int i=0; i<number_tasks; i++){
+    info[i].priority = rand();
+  }
+
+  printf("Queue depth of %d tasks\n", number_tasks);
+
+  deep_queue(1, "Binary Heap", compare, info, number_tasks);
+  deep_queue(1, "Binary Heap (key)", NULL, info, number_tasks);
+  deep_queue(2, "Binomial Heap", compare, info, number_tasks);
+  deep_queue(2, "Binomial Heap (key)", NULL, info, number_tasks);
+  deep_queue(12, "Lazy Binomial Heap", compare, info, number_tasks);
+  deep_queue(12, "Lazy Binomial Heap (key)", NULL, info, number_tasks);
+  deep_queue(3, "Fibonacci Heap", compare, info, number_tasks);
+  deep_queue(3, "Fibonacci Heap (key)", NULL, info, number_tasks);
+  deep_queue(9, "Array Binary Heap", compare, info, number_tasks);
+  deep_queue(9, "Array Binary Heap (key)", NULL, info, number_tasks);
+  deep_queue(10, "8-ary Heap", NULL, info, number_tasks);
+
+  //the Bucket Queue only keeps 256 levels
+  for(int i=0; i<number_tasks; i++){
+    info[i].priority = info[i].priority%256;
+  }
+  deep_queue(11, "Bucket Queue", NULL, info, number_tasks);
+
+  printf("\nFibonacci Heap by queue depth\n");
+  for(int i=0; i<number_tasks; i++){
+    info[i].priority = rand();
+  }
+  char name[32];
+  for(int depth=1000; depth<=number_tasks; depth=depth*10){
+    snprintf(name, sizeof(name), "%d tasks", depth);
+    deep_queue(3, name, NULL, info, depth);
+  }
+
+  printf("\nParallel loop of %d iterations\n", number_tasks*10);
+  loop_benchmark((long)number_tasks*10);
+
+  int* values = malloc(number_tasks*sizeof(int));
+  for(int i=0; i<number_tasks; i++){
+    values[i] = rand();
+  }
+
+  printf("\nRecursive quicksort of %d integers\n", number_tasks);
+  recursive_sort(0, "Without pool", values, number_tasks);
+  recursive_sort(4, "FIFO Queue", values, number_tasks);
+  recursive_sort(7, "Work Stealing LIFO", values, number_tasks);
+  free(values);
+
+  free(info);
+  return 0;
+}
@@ -4,28 +4,73 @@
 /*
 
 This header contains the functions for the different types of queues 
-that are supported with the thread pool. The five options are:
+that are supported with the thread pool. The options are:
 
 1. Binary Heap
 2. Binomial Heap
 3. Fibonacci Heap
 4. First In First Out Queue
 5. Last In First Out Queue
+6. Work Stealing Deques (First In First Out per thread)
+7. Work Stealing Deques (Last In First Out per thread)
+8. Lock-free Ring Buffer (First In First Out)
+9. Binary Heap stored in an array
+10. 8-ary Heap of integer priorities
+11. Bucket Queue of priority levels 0 to 255
+12. Lazy Binomial Heap
+
+Options 1 through 5 and 9 through 12 are only accessed while holding 
+pool->modify_pool.
+The work stealing and ring buffer options are accessed without it.
 
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <sched.h>
+#if defined(__AVX2__) || defined(__SSE4_2__)
+#include <immintrin.h>
+#endif
 #include "structs.h"
 
+//--------Priority Comparison Function Declarations
+static inline int task_compare(const struct task* a, const struct task* b, struct thread_pool* pool);
+static inline int heap_entry_compare(const struct heap_entry* a, const struct heap_entry* b, struct thread_pool* pool);
+
 //--------Binary Heap Function Declarations
-void binary_swap(struct task* a, struct task* b);
+void binary_swap(struct task* child, struct thread_pool* pool);
 struct task* binary_find_task(struct thread_pool* pool, int position);
 struct task* binary_h_p_child(struct task* parent, struct thread_pool* pool);
 void binary_bubble_up(struct task* new_task, struct thread_pool* pool);
-void binary_bubble_down(struct thread_pool* pool);
+void binary_bubble_down(struct task* to_move, struct thread_pool* pool);
 void binary_push_task(struct task* to_add, struct thread_pool* pool);
 struct task* binary_pull_task(struct thread_pool* pool);
+void binary_update_task(struct task* to_update, int64_t priority, struct thread_pool* pool);
+void binary_remove_task(struct task* to_remove, struct thread_pool* pool);
+void binary_sift_down_array(struct task* nodes[], unsigned int position, unsigned int total, struct thread_pool* pool);
+void binary_push_batch(struct task* to_add[], int n, struct thread_pool* pool);
+
+//--------Array Binary Heap Function Declarations
+int array_heap_reserve(unsigned int size, struct thread_pool* pool);
+void array_heap_sift_up(unsigned int position, struct thread_pool* pool);
+void array_heap_sift_down(unsigned int position, unsigned int size, struct thread_pool* pool);
+void array_heap_push_task(struct task* to_add, struct thread_pool* pool);
+struct task* array_heap_pull_task(struct thread_pool* pool);
+void array_heap_push_batch(struct task* to_add[], int n, struct thread_pool* pool);
+void array_heap_update_task(struct task* to_update, int64_t priority, struct thread_pool* pool);
+void array_heap_remove_task(struct task* to_remove, struct thread_pool* pool);
+
+//--------8-ary Heap Function Declarations
+int dary_reserve(unsigned int size, struct thread_pool* pool);
+int dary_max_child(const int64_t* keys);
+void dary_sift_up(unsigned int position, struct thread_pool* pool);
+void dary_sift_down(unsigned int position, unsigned int end, struct thread_pool* pool);
+void dary_push_task(struct task* to_add, struct thread_pool* pool);
+struct task* dary_pull_task(struct thread_pool* pool);
+void dary_push_batch(struct task* to_add[], int n, struct thread_pool* pool);
+void dary_update_task(struct task* to_update, int64_t priority, struct thread_pool* pool);
+void dary_remove_task(struct task* to_remove, struct thread_pool* pool);
 
 //--------Binomial Heap Function Declarations
 void binomial_make_child(struct task** ref_child, struct task* parent);
@@ -35,6 +80,20 @@ struct task* binomial_consolidate(struct task* head, struct thread_pool* pool);
 struct task* binomial_make_union(struct task* h1, struct task* h2, struct thread_pool* pool);
 void binomial_push_task(struct task* to_add, struct thread_pool* pool);
 struct task* binomial_pull_task(struct thread_pool* pool);
+struct task* binomial_link(struct task* a, struct task* b, struct thread_pool* pool);
+void binomial_push_batch(struct task* to_add[], int n, struct thread_pool* pool);
+void binomial_swap(struct task* child, struct thread_pool* pool);
+void binomial_update_task(struct task* to_update, int64_t priority, struct thread_pool* pool);
+void binomial_remove_root(struct task** ref_root, struct task* root, struct thread_pool* pool);
+void binomial_remove_task(struct task* to_remove, struct thread_pool* pool);
+
+//--------Lazy Binomial Heap Function Declarations
+struct task* lazy_binomial_link(struct task* a, struct task* b, struct thread_pool* pool);
+void lazy_binomial_consolidate(struct task* removed, struct thread_pool* pool);
+void lazy_binomial_push_task(struct task* to_add, struct thread_pool* pool);
+struct task* lazy_binomial_pull_task(struct thread_pool* pool);
+void lazy_binomial_update_task(struct task* to_update, int64_t priority, struct thread_pool* pool);
+void lazy_binomial_remove_task(struct task* to_remove, struct thread_pool* pool);
 
 //--------Fibonacci Heap Function Declarations
 struct task* fibonacci_make_child(struct task* a, struct task* b, struct thread_pool* pool);
@@ -45,14 +104,96 @@ void fibonacci_set_parent_null(struct task* a);
 void fibonacci_unsplice(struct task* a);
 void fibonacci_push_task(struct task* to_add, struct thread_pool* pool);
 struct task* fibonacci_pull_task(struct thread_pool* pool);
+void fibonacci_push_batch(struct task* to_add[], int n, struct thread_pool* pool);
+void fibonacci_cut(struct task* to_cut, struct thread_pool* pool);
+void fibonacci_cascading_cut(struct task* parent, struct thread_pool* pool);
+void fibonacci_update_task(struct task* to_update, int64_t priority, struct thread_pool* pool);
+void fibonacci_remove_task(struct task* to_remove, struct thread_pool* pool);
 
 //--------FIFO Function Declarations
 void FIFO_push_task(struct task* to_add, struct thread_pool* pool);
 struct task* FIFO_pull_task(struct thread_pool* pool);
+void FIFO_remove_task(struct task* to_remove, struct thread_pool* pool);
 
 //--------LIFO Function Declarations
 void LIFO_push_task(struct task* to_add, struct thread_pool* pool);
 struct task* LIFO_pull_task(struct thread_pool* pool);
+void LIFO_remove_task(struct task* to_remove, struct thread_pool* pool);
+
+//--------Work Stealing Function Declarations
+struct ws_array* ws_array_create(long size);
+int ws_deque_init(struct ws_deque* q);
+void ws_deque_free(struct ws_deque* q);
+int ws_deque_push(struct ws_deque* q, struct task* to_add);
+struct task* ws_deque_take(struct ws_deque* q);
+int ws_deque_steal(struct ws_deque* q, struct task** stolen);
+void ws_inbox_push(struct thread_info* worker, struct task* to_add);
+void ws_inbox_push_many(struct thread_info* worker, struct task* to_add[], int n);
+struct task* ws_inbox_take_one(struct thread_info* worker);
+int ws_inbox_drain(struct thread_info* worker);
+struct task* ws_steal_task(struct thread_pool* pool, struct thread_info* self);
+void ws_push_task(struct task* to_add, struct thread_pool* pool);
+struct thread_info* ws_next_inbox(struct thread_pool* pool, struct thread_info* target);
+void ws_push_batch(struct task* to_add[], int n, struct thread_pool* pool);
+struct task* ws_FIFO_pull_task(struct thread_pool* pool);
+struct task* ws_LIFO_pull_task(struct thread_pool* pool);
+
+//--------Ring Buffer Function Declarations
+struct ring_buffer* ring_create(size_t capacity);
+void ring_free(struct ring_buffer* r);
+void ring_push_task(struct task* to_add, struct thread_pool* pool);
+struct task* ring_pull_task(struct thread_pool* pool);
+
+//--------Bucket Queue Function Declarations
+struct bucket_queue* bucket_create(void);
+int bucket_level(int64_t priority);
+void bucket_push_task(struct task* to_add, struct thread_pool* pool);
+struct task* bucket_pull_task(struct thread_pool* pool);
+void bucket_update_task(struct task* to_update, int64_t priority, struct thread_pool* pool);
+void bucket_remove_task(struct task* to_remove, struct thread_pool* pool);
+
+//runs a task and releases it. Defined in thread_pool.c
+void run_task(struct task* to_do, struct thread_pool* pool);
+//wakes sleeping threads. Defined in thread_pool.c
+void wake_threads(struct thread_pool* pool, int n);
+
+/*The worker running on the calling thread. NULL if the calling thread
+is not part of a thread pool.
+*/
+static _Thread_local struct thread_info* current_worker = NULL;
+
+
+
+//==================Priority Comparison Functions==================
+/*
+  Returns greater than 0 if 'a' has higher priority than 'b', 0 if
+  they are equal and less than 0 otherwise. Pools created without a
+  comparison function compare the integer priority of the tasks
+  inline, which avoids calling through a pointer and reading the
+  arguments.
+*/
+static inline int task_compare(const struct task* a, const struct task* b, struct thread_pool* pool){
+
+  if(pool->comp_function == NULL){
+    return (a->priority > b->priority) - (a->priority < b->priority);
+  }
+  if(a->internal || b->internal){
+    return a->internal - b->internal;
+  }
+  return pool->comp_function(a->arg, b->arg);
+}
+
+//Same as task_compare for the entries of the array heap
+static inline int heap_entry_compare(const struct heap_entry* a, const struct heap_entry* b, struct thread_pool* pool){
+
+  if(pool->comp_function == NULL){
+    return (a->priority > b->priority) - (a->priority < b->priority);
+  }
+  if(a->task->internal || b->task->internal){
+    return a->task->internal - b->task->internal;
+  }
+  return pool->comp_function(a->arg, b->arg);
+}
 
 
 
@@ -63,20 +204,54 @@ struct task* LIFO_pull_task(struct thread_pool* pool);
 */
 
 
-//swaps the arguments and functions associated with two tasks
-void binary_swap(struct task* a, struct task* b){
+/*Exchanges the places of 'child' and its parent in the tree. The 
+tasks are relinked rather than having their contents swapped so a task
+stays the same node from push to pull, which handles returned by 
+add_task_future rely on.
+*/
+void binary_swap(struct task* child, struct thread_pool* pool){
+
+  struct task* parent = child->parent;
+  struct task* grandparent = parent->parent;
+  struct task* left = child->pointer1;
+  struct task* right = child->pointer2;
+
+  if(parent->pointer1 == child){
+    child->pointer1 = parent;
+    child->pointer2 = parent->pointer2;
+    if(child->pointer2 != NULL){
+      child->pointer2->parent = child;
+    }
+  }
+  else{
+    child->pointer2 = parent;
+    child->pointer1 = parent->pointer1;
+    if(child->pointer1 != NULL){
+      child->pointer1->parent = child;
+    }
+  }
 
-  void* temp_arg;
-  void (*temp_function)(void*);
+  parent->pointer1 = left;
+  parent->pointer2 = right;
+  if(left != NULL){
+    left->parent = parent;
+  }
+  if(right != NULL){
+    right->parent = parent;
+  }
 
-  temp_arg = a->arg;
-  a->arg = b->arg;
-  b->arg = temp_arg;
-  
-  temp_function = a->function;
-  a->function = b->function;
-  b->function = temp_function;
+  parent->parent = child;
+  child->parent = grandparent;
 
+  if(grandparent == NULL){
+    pool->head = child;
+  }
+  else if(grandparent->pointer1 == parent){
+    grandparent->pointer1 = child;
+  }
+  else{
+    grandparent->pointer2 = child;
+  }
   return;
 }
 
@@ -136,7 +311,7 @@ struct task* binary_h_p_child(struct task* parent, struct thread_pool* pool){
       return parent->pointer1;
     }
     else{
-      if(pool->comp_function(parent->pointer1->arg, parent->pointer2->arg) >= 0){
+      if(task_compare(parent->pointer1, parent->pointer2, pool) >= 0){
 	return parent->pointer1;
       }
       else{
@@ -158,9 +333,8 @@ void binary_bubble_up(struct task* to_add, struct thread_pool* pool){
   
   while(curr->parent != NULL){
 
-    if(pool->comp_function(curr->arg, curr->parent->arg) > 0){
-      binary_swap(curr, curr->parent);
-      curr = curr->parent;
+    if(task_compare(curr, curr->parent, pool) > 0){
+      binary_swap(curr, pool);
     }
     else{
       break;
@@ -169,22 +343,21 @@ void binary_bubble_up(struct task* to_add, struct thread_pool* pool){
   return;
 }
 
-/*Pushes pool->head down until the max heap property is 
+/*Pushes 'to_move' down until the max heap property is 
 restored.
 */
-void binary_bubble_down(struct thread_pool* pool){
+void binary_bubble_down(struct task* to_move, struct thread_pool* pool){
 
   struct task* next;
-  struct task* curr = pool->head;
+  struct task* curr = to_move;
 
   while(1){
     next = binary_h_p_child(curr, pool);
     if(next == NULL){
       break;
     }
-    else if(pool->comp_function(next->arg, curr->arg) > 0){
-      binary_swap(next, curr);
-      curr = next;
+    else if(task_compare(next, curr, pool) > 0){
+      binary_swap(next, pool);
     }
     else{
       break;
@@ -235,555 +408,2486 @@ void binary_push_task(struct task* to_add, struct thread_pool* pool){
 }
 
 /*Function returns the task pointed to by pool->head. This is the highest
-priority task. The last task is swapped with the head. The former head is
-seperated from heap and the new head is pushed down until the max heap
+priority task. The last task is seperated from the heap and takes the 
+place of the head. The new head is pushed down until the max heap
 property is restored.
 */
 struct task* binary_pull_task(struct thread_pool* pool){
 
-  struct task* curr = pool->head;
+  struct task* to_return = pool->head;
 
   //If only one task in heap
-  if(curr->pointer1 == NULL){
+  if(to_return->pointer1 == NULL){
     pool->head = NULL;
-    return curr;
+    return to_return;
   }
 
   //find the last task
-  curr = binary_find_task(pool, pool->num_tasks_in_queue);
+  struct task* last = binary_find_task(pool, pool->num_tasks_in_queue);
   
-  //swap last and head
-  binary_swap(curr, pool->head);
-  
-  //seperate curr (now highest priority task)
-  //The modular test determines if curr is a right or left child
+  //seperate last
+  //The modular test determines if last is a right or left child
   if(pool->num_tasks_in_queue%2 == 0){
-    curr->parent->pointer1 = NULL;
+    last->parent->pointer1 = NULL;
   }
   else{
-    curr->parent->pointer2 = NULL;
+    last->parent->pointer2 = NULL;
   }
-  
-  curr->parent = NULL;
+
+  //last takes the place of the head
+  last->pointer1 = to_return->pointer1;
+  last->pointer2 = to_return->pointer2;
+  if(last->pointer1 != NULL){
+    last->pointer1->parent = last;
+  }
+  if(last->pointer2 != NULL){
+    last->pointer2->parent = last;
+  }
+  last->parent = NULL;
+  pool->head = last;
     
-  binary_bubble_down(pool);
+  binary_bubble_down(last, pool);
 
-  return curr;
+  return to_return;
 }
 
-
-
-//====================Binomial Heap Functions======================
-/*
-  For Binomial Heap functions 'pointer1' refers to the task's sibling.
+/*Gives a task in the heap a new priority. It is bubbled up if it now 
+beats its parent and pushed down otherwise.
 */
+void binary_update_task(struct task* to_update, int64_t priority, struct thread_pool* pool){
 
-/*Accepts a reference to a task, 'ref_child' that is to be made into
- a child of the task 'parent'. The child task must be the parent 
-task's rightmost child. The if ... else statement ensures this is 
-the case.
-*/ 
-void binomial_make_child(struct task** ref_child, struct task* parent){
+  to_update->priority = priority;
 
-  struct task* child = (*ref_child);
+  if(to_update->parent != NULL && task_compare(to_update, to_update->parent, pool) > 0){
+    binary_bubble_up(to_update, pool);
+  }
+  else{
+    binary_bubble_down(to_update, pool);
+  }
+  return;
+}
 
-  //cut the child task from the root list
-  (*ref_child) = child->pointer1;
-  child->parent = parent;
+/*Takes 'to_remove' out of the heap. The last task is separated from 
+the heap as in binary_pull_task, takes the place of 'to_remove' and is
+then moved up or down to where it belongs.
+*/
+void binary_remove_task(struct task* to_remove, struct thread_pool* pool){
 
-  if(parent->child == NULL){
-    parent->child = child;
-    child->pointer1 = NULL;
+  struct task* last = binary_find_task(pool, pool->num_tasks_in_queue);
+
+  if(last->parent == NULL){
+    pool->head = NULL;
+    return;
+  }
+  else if(pool->num_tasks_in_queue%2 == 0){
+    last->parent->pointer1 = NULL;
   }
   else{
-    struct task* prev = parent->child;
-    struct task* next = parent->child->pointer1;
-    while(next != NULL){
-      prev = prev->pointer1;
-      next = next->pointer1;
-    }
-    prev->pointer1 = child;
-    child->pointer1 = NULL;
+    last->parent->pointer2 = NULL;
   }
-  parent->order++;
 
-  return;
-}
-  
+  if(last == to_remove){
+    return;
+  }
 
-/*binomial_make_child compares two tasks of equal order and makes the
-lower priority task the child of the higher priority task. The two 
-tasks compared are 'curr' and 'curr->pointer1', the right sibling of 
-'curr'. The pointer to a pointer 'ref_prev' points to a pointer to 
-'curr'. This allows 'curr' to be removed from the root list if it is
-lower in priority.
- */
-void binomial_combine(struct task** ref_prev, struct task* curr, struct thread_pool* pool){
+  //last takes the place of to_remove
+  last->pointer1 = to_remove->pointer1;
+  last->pointer2 = to_remove->pointer2;
+  last->parent = to_remove->parent;
+  if(last->pointer1 != NULL){
+    last->pointer1->parent = last;
+  }
+  if(last->pointer2 != NULL){
+    last->pointer2->parent = last;
+  }
 
-  if(pool->comp_function(curr->arg, curr->pointer1->arg) >= 0){
-   
-    binomial_make_child(&(curr->pointer1), curr);
-  } 
+  if(last->parent == NULL){
+    pool->head = last;
+  }
+  else if(last->parent->pointer1 == to_remove){
+    last->parent->pointer1 = last;
+  }
   else{
-        binomial_make_child(ref_prev, curr->pointer1);
+    last->parent->pointer2 = last;
   }
+
+  binary_update_task(last, last->priority, pool);
   return;
 }
 
-/*merges two linked lists by order
- 2->4->5-> and 1->3->8->
-merges to 1->2->3->4->5->8->
+/*Sifts the task at 'position' of the array 'nodes' down until it is of
+higher priority than both of its children. 'nodes' holds a heap in 
+position order starting at index 1. Only the array is changed.
 */
-struct task* binomial_simple_merge(struct task* h1, struct task* h2){
-  
-  struct task* new_head;
+void binary_sift_down_array(struct task* nodes[], unsigned int position, unsigned int total, struct thread_pool* pool){
 
-  //reference to the pointer where the next node will be appended
-  struct task** ref_next = &new_head;
+  struct task* moving = nodes[position];
+  unsigned int child;
 
-  while(1){
+  while(2*position <= total){
 
-    if(h1 == NULL){
-      
-      (*ref_next) = h2;  
-      return new_head;
-    }
-    else if(h2 == NULL){
-      
-      (*ref_next) = h1;
-      return new_head;
+    child = 2*position;
+    if(child+1 <= total && task_compare(nodes[child+1], nodes[child], pool) > 0){
+      child++;
     }
 
-    if(h1->order <= h2->order){
-      
-      (*ref_next) = h1;
-      h1 = h1->pointer1;
+    if(task_compare(nodes[child], moving, pool) > 0){
+      nodes[position] = nodes[child];
+      position = child;
     }
     else{
-      
-      (*ref_next) = h2;
-      h2 = h2->pointer1;
+      break;
     }
-
-    ref_next = &((*ref_next)->pointer1);
   }
+  nodes[position] = moving;
+  return;
 }
 
-/*take a linked list with ascending order and  consolidate into a
-linked list that obeys the binomial heap property that every the
-linked list can only have at most one of each order task.
-For example: 1->1->4->5->5->
-will consolidate down to 2->4->6->
+/*
+Pushes 'n' tasks into the Binary Heap at once. pool->num_tasks_in_queue
+already includes them. If the batch is smaller than the heap it is 
+cheaper to push the tasks one at a time. Otherwise every task, old and
+new, is gathered into an array in position order, the array is made
+into a heap bottom up in O(n) and the tree is relinked from it.
 */
-struct task* binomial_consolidate(struct task* head, struct thread_pool* pool){
-
-  //keep a reference to the previous task to allow removal of curr task
-  struct task** ref_prev = &head;
-
-  struct task* curr = head;
+void binary_push_batch(struct task* to_add[], int n, struct thread_pool* pool){
 
-  /*there are three cases to consider as moving through linked list
-   1. curr task and curr->pointer1 have different order. In this case
-      advance curr.
-   2. curr and curr->pointer1  and curr->pointer1->pointer1 have the 
-      same order. In this case advance curr.
-   3. curr and curr->pointer1 have the same order and curr->pointer1->
-      pointer1 does not have the same order as the prev to tasks.
-      Make the lower priority of curr and curr->pointer1 the child of
-      of the higher priority task.
-  */
-  
-  while(curr->pointer1 != NULL){
+  unsigned int total = pool->num_tasks_in_queue;
+  unsigned int existing = total - n;
+  struct task** nodes = NULL;
 
-    //Case 1
-    if(curr->order != curr->pointer1->order){
+  if((unsigned int)n >= existing){
+    nodes = malloc((total+1)*sizeof(struct task*));
+  }
 
-      curr = curr->pointer1;
-      ref_prev = &((*ref_prev)->pointer1);
+  if(nodes == NULL){
+    for(int i=0; i<n; i++){
+      pool->num_tasks_in_queue = existing+i+1;
+      binary_push_task(to_add[i], pool);
     }
-    else{
-      //Case 2
-      if(curr->pointer1->pointer1 != NULL && curr->pointer1->pointer1->order == curr->order){
-	
-      curr = curr->pointer1;
-      ref_prev = &((*ref_prev)->pointer1);
-      }
-      //Case 3
-      else{
-	binomial_combine(ref_prev, curr, pool);
-	curr = (*ref_prev);
-      }
+    return;
+  }
+
+  //the children of position p are at 2p and 2p+1
+  nodes[1] = pool->head;
+  for(unsigned int p=1; 2*p <= existing; p++){
+    nodes[2*p] = nodes[p]->pointer1;
+    if(2*p+1 <= existing){
+      nodes[2*p+1] = nodes[p]->pointer2;
     }
   }
+  for(int i=0; i<n; i++){
+    nodes[existing+1+i] = to_add[i];
+  }
 
-    return head;
-}
+  for(unsigned int p=total/2; p>=1; p--){
+    binary_sift_down_array(nodes, p, total, pool);
+  }
 
-struct task* binomial_make_union(struct task* h1, struct task* h2, struct thread_pool* pool){
-  struct task* head = binomial_simple_merge(h1, h2);  
-  head = binomial_consolidate(head, pool);
+  for(unsigned int p=1; p<=total; p++){
+    nodes[p]->parent = (p > 1) ? nodes[p/2] : NULL;
+    nodes[p]->pointer1 = (2*p <= total) ? nodes[2*p] : NULL;
+    nodes[p]->pointer2 = (2*p+1 <= total) ? nodes[2*p+1] : NULL;
+  }
+  pool->head = nodes[1];
 
-  return head;
+  free(nodes);
+  return;
 }
 
-void binomial_push_task(struct task* to_add, struct thread_pool* pool){
- 
-  to_add->order = 0;
-  to_add->pointer1 = NULL;
-  to_add->parent = NULL;
-  to_add->child = NULL;
 
-  if(pool->head == NULL){
-    pool->head = to_add;
+
+//====================Array Binary Heap Functions==================
+/*
+  The same max heap as above stored in pool->heap_array instead of a
+  tree of tasks. The children of index i are at 2i+1 and 2i+2 and its
+  parent is at (i-1)/2, so moving through the heap is index arithmetic
+  over contiguous memory rather than chasing pointers. The array grows
+  by doubling and never shrinks. pool->num_tasks_in_queue is the 
+  number of entries in use, and already counts the task being pushed.
+  Every task keeps the index of its entry in 'heap_index', set 
+  whenever an entry is stored, so a task can be found in O(1) to 
+  change its priority or take it out.
+*/
+
+#define ARRAY_HEAP_MIN 64
+
+//Makes room for 'size' entries. Returns 0 if memory ran out
+int array_heap_reserve(unsigned int size, struct thread_pool* pool){
+
+  if(size <= pool->heap_capacity){
+    return 1;
   }
-  else{
-    pool->head = binomial_make_union(pool->head, to_add, pool);
-    
+
+  unsigned int capacity = (pool->heap_capacity > 0) ? pool->heap_capacity : ARRAY_HEAP_MIN;
+  while(capacity < size){
+    capacity = capacity*2;
   }
-  return;
+
+  struct heap_entry* bigger = realloc(pool->heap_array, capacity*sizeof(struct heap_entry));
+  if(bigger == NULL){
+    printf("ERROR: Could not grow array heap\n");
+    return 0;
+  }
+
+  pool->heap_array = bigger;
+  pool->heap_capacity = capacity;
+  return 1;
 }
 
-struct task* binomial_pull_task(struct thread_pool* pool){
+/*Moves the entry at 'position' up until its parent has higher 
+priority. Parents are moved down into the hole instead of swapping.
+*/
+void array_heap_sift_up(unsigned int position, struct thread_pool* pool){
 
-  struct task* highest_priority = pool->head;
-  struct task** ref_prev_high_p = &(pool->head);
-  struct task* curr = pool->head->pointer1;
+  struct heap_entry* heap = pool->heap_array;
+  struct heap_entry moving = heap[position];
+  unsigned int parent;
 
-  if(curr == NULL){
+  while(position > 0){
 
-    pool->head = highest_priority->child;
-    return highest_priority;
+    parent = (position-1)/2;
+    if(heap_entry_compare(&moving, &heap[parent], pool) > 0){
+      heap[position] = heap[parent];
+      heap[position].task->heap_index = position;
+      position = parent;
+    }
+    else{
+      break;
+    }
   }
-  struct task** ref_prev = &(pool->head->pointer1);
-			      
-  while(curr != NULL){
+  heap[position] = moving;
+  moving.task->heap_index = position;
+  return;
+}
 
-    if(pool->comp_function(curr->arg, highest_priority->arg) > 0){
+/*Moves the entry at 'position' down until both children have lower
+priority. 'size' is the number of entries in the heap.
+*/
+void array_heap_sift_down(unsigned int position, unsigned int size, struct thread_pool* pool){
 
-      ref_prev_high_p = ref_prev;
-      highest_priority = curr;
+  struct heap_entry* heap = pool->heap_array;
+  struct heap_entry moving = heap[position];
+  unsigned int child;
+
+  while(2*position+1 < size){
+
+    child = 2*position+1;
+    if(child+1 < size && heap_entry_compare(&heap[child+1], &heap[child], pool) > 0){
+      child++;
     }
 
-    curr = curr->pointer1;
-    ref_prev = &((*ref_prev)->pointer1);
+    if(heap_entry_compare(&heap[child], &moving, pool) > 0){
+      heap[position] = heap[child];
+      heap[position].task->heap_index = position;
+      position = child;
+    }
+    else{
+      break;
+    }
   }
+  heap[position] = moving;
+  moving.task->heap_index = position;
+  return;
+}
 
-  (*ref_prev_high_p) = (highest_priority->pointer1);
-  struct task* new_task = binomial_make_union(pool->head, highest_priority->child, pool);
-  pool->head = new_task;
-  
-  highest_priority->pointer1 = NULL;
-  highest_priority->child = NULL;
-  highest_priority->parent = NULL;
+/*If the array can not grow the task is not added, and the count that
+submit_task already took is given back so no pull reads its slot.
+*/
+void array_heap_push_task(struct task* to_add, struct thread_pool* pool){
 
-  return highest_priority;
-}
+  unsigned int position = pool->num_tasks_in_queue-1;
 
+  if(!array_heap_reserve(position+1, pool)){
+    printf("ERROR: Task was not added to the array heap\n");
+    pool->num_tasks_in_queue--;
+    to_add->queued = 0;
+    return;
+  }
 
-//====================Fibonacci Heap Functions=====================
+  pool->heap_array[position].arg = to_add->arg;
+  pool->heap_array[position].priority = to_add->priority;
+  pool->heap_array[position].task = to_add;
+  array_heap_sift_up(position, pool);
+  return;
+}
 
-/*
-  For Fibonacci Heap functions 'pointer1' refers to the task's left
-  child pointer and 'pointer2' refers to the right child pointer.
+/*Returns the task at the root. The last entry takes its place and is
+sifted down.
 */
+struct task* array_heap_pull_task(struct thread_pool* pool){
 
+  unsigned int size = pool->num_tasks_in_queue;
+  struct task* to_return = pool->heap_array[0].task;
 
-/*
-  Makes task 'b' into a child of task 'a'. If 'a' has children 'b'
-  will be spliced into the child list.
+  pool->heap_array[0] = pool->heap_array[size-1];
+  if(size > 1){
+    array_heap_sift_down(0, size-1, pool);
+  }
+  return to_return;
+}
+
+/*Appends the 'n' tasks. If the batch is at least as big as the heap 
+the whole array is heapified bottom up, otherwise each new entry is 
+sifted up.
 */
-struct task* fibonacci_make_child(struct task* a, struct task* b, struct thread_pool* pool){
+void array_heap_push_batch(struct task* to_add[], int n, struct thread_pool* pool){
 
-  //remove b from root list
-  struct task* left_neighbor = b->pointer1;
-  struct task* right_neighbor = b->pointer2;
+  unsigned int total = pool->num_tasks_in_queue;
+  unsigned int existing = total - n;
 
-  if(a->child == NULL){
-    a->child = b;
-    b->pointer1 = b;
+  if(!array_heap_reserve(total, pool)){
+    printf("ERROR: Batch of %d tasks was not added to the array heap\n", n);
+    pool->num_tasks_in_queue = existing;
+    return;
+  }
+
+  for(int i=0; i<n; i++){
+    pool->heap_array[existing+i].arg = to_add[i]->arg;
+    pool->heap_array[existing+i].priority = to_add[i]->priority;
+    pool->heap_array[existing+i].task = to_add[i];
+    to_add[i]->heap_index = existing+i;
+  }
+
+  if((unsigned int)n >= existing){
+    for(unsigned int p=total/2; p>0; p--){
+      array_heap_sift_down(p-1, total, pool);
+    }
+  }
+  else{
+    for(unsigned int p=existing; p<total; p++){
+      array_heap_sift_up(p, pool);
+    }
+  }
+  return;
+}
+
+//Gives a task in the heap a new priority and sifts its entry up or down
+void array_heap_update_task(struct task* to_update, int64_t priority, struct thread_pool* pool){
+
+  unsigned int size = pool->num_tasks_in_queue;
+  unsigned int position = to_update->heap_index;
+
+  to_update->priority = priority;
+  pool->heap_array[position].priority = priority;
+
+  array_heap_sift_up(position, pool);
+  if(pool->heap_array[position].task == to_update){
+    array_heap_sift_down(position, size, pool);
+  }
+  return;
+}
+
+/*Takes 'to_remove' out of the heap. The last entry fills its place and
+is sifted up or down.
+*/
+void array_heap_remove_task(struct task* to_remove, struct thread_pool* pool){
+
+  unsigned int last = pool->num_tasks_in_queue-1;
+  unsigned int position = to_remove->heap_index;
+  struct task* moved = pool->heap_array[last].task;
+
+  if(position == last){
+    return;
+  }
+
+  pool->heap_array[position] = pool->heap_array[last];
+  array_heap_sift_up(position, pool);
+  if(pool->heap_array[position].task == moved){
+    array_heap_sift_down(position, last, pool);
+  }
+  return;
+}
+
+//====================8-ary Heap Functions=========================
+/*
+  A max heap on task->priority where every node has eight children.
+  The keys are kept in pool->dary_keys apart from the tasks in 
+  pool->dary_tasks so the eight keys of a family fill exactly one 64 
+  byte cache line. To line the families up with cache lines the root 
+  is stored at index 7 and indices 0 through 6 are unused:
+
+  the children of index i are at 8(i-6) through 8(i-6)+7
+  the parent of index c is at c/8+6
+
+  With n tasks the heap occupies indices 7 through n+6. Every unused
+  slot holds INT64_MIN, so the largest of a family can always be found
+  by comparing all eight keys at once with SIMD instructions. When 
+  compiled with -mavx2 (or -msse4.2) dary_max_child uses them;
+  otherwise it falls back to a plain loop. As in the array binary heap
+  every task keeps its index in 'heap_index'.
+*/
+
+#define DARY_ROOT 7
+#define DARY_MIN 64
+
+/*Makes room for 'size' tasks. The keys are reallocated on a 64 byte
+boundary and new slots are filled with INT64_MIN. Returns 0 if memory
+ran out.
+*/
+int dary_reserve(unsigned int size, struct thread_pool* pool){
+
+  //the last family must fit entirely
+  unsigned int needed = (DARY_ROOT + size + 7) & ~7u;
+
+  if(needed <= pool->dary_capacity){
+    return 1;
+  }
+
+  unsigned int capacity = (pool->dary_capacity > 0) ? pool->dary_capacity : DARY_MIN;
+  while(capacity < needed){
+    capacity = capacity*2;
+  }
+
+  int64_t* keys = aligned_alloc(64, capacity*sizeof(int64_t));
+  struct task** tasks = realloc(pool->dary_tasks, capacity*sizeof(struct task*));
+  if(keys == NULL || tasks == NULL){
+    printf("ERROR: Could not grow 8-ary heap\n");
+    free(keys);
+    if(tasks != NULL){
+      pool->dary_tasks = tasks;
+    }
+    return 0;
+  }
+
+  unsigned int i = 0;
+  if(pool->dary_keys != NULL){
+    for(; i<pool->dary_capacity; i++){
+      keys[i] = pool->dary_keys[i];
+    }
+    free(pool->dary_keys);
+  }
+  for(; i<capacity; i++){
+    keys[i] = INT64_MIN;
+  }
+
+  pool->dary_keys = keys;
+  pool->dary_tasks = tasks;
+  pool->dary_capacity = capacity;
+  return 1;
+}
+
+/*Returns the index, 0 through 7, of the largest of the eight keys in 
+the cache line at 'keys'. Ties go to the lowest index.
+*/
+int dary_max_child(const int64_t* keys){
+
+#if defined(__AVX2__)
+  __m256i a = _mm256_load_si256((const __m256i*)keys);
+  __m256i b = _mm256_load_si256((const __m256i*)(keys+4));
+
+  //reduce to the maximum in every lane
+  __m256i m = _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(b, a));
+  __m256i s = _mm256_permute4x64_epi64(m, _MM_SHUFFLE(1,0,3,2));
+  m = _mm256_blendv_epi8(m, s, _mm256_cmpgt_epi64(s, m));
+  s = _mm256_shuffle_epi32(m, _MM_SHUFFLE(1,0,3,2));
+  m = _mm256_blendv_epi8(m, s, _mm256_cmpgt_epi64(s, m));
+
+  int mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(a, m)))
+    | (_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(b, m))) << 4);
+  return __builtin_ctz(mask);
+
+#elif defined(__SSE4_2__)
+  __m128i v0 = _mm_load_si128((const __m128i*)keys);
+  __m128i v1 = _mm_load_si128((const __m128i*)(keys+2));
+  __m128i v2 = _mm_load_si128((const __m128i*)(keys+4));
+  __m128i v3 = _mm_load_si128((const __m128i*)(keys+6));
+
+  __m128i m01 = _mm_blendv_epi8(v0, v1, _mm_cmpgt_epi64(v1, v0));
+  __m128i m23 = _mm_blendv_epi8(v2, v3, _mm_cmpgt_epi64(v3, v2));
+  __m128i m = _mm_blendv_epi8(m01, m23, _mm_cmpgt_epi64(m23, m01));
+  __m128i s = _mm_shuffle_epi32(m, _MM_SHUFFLE(1,0,3,2));
+  m = _mm_blendv_epi8(m, s, _mm_cmpgt_epi64(s, m));
+
+  int mask = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(v0, m)))
+    | (_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(v1, m))) << 2)
+    | (_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(v2, m))) << 4)
+    | (_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(v3, m))) << 6);
+  return __builtin_ctz(mask);
+
+#else
+  int best = 0;
+  for(int i=1; i<8; i++){
+    if(keys[i] > keys[best]){
+      best = i;
+    }
+  }
+  return best;
+#endif
+}
+
+//Moves the task at 'position' up until its parent's key is not smaller
+void dary_sift_up(unsigned int position, struct thread_pool* pool){
+
+  int64_t* keys = pool->dary_keys;
+  struct task** tasks = pool->dary_tasks;
+  int64_t key = keys[position];
+  struct task* moving = tasks[position];
+  unsigned int parent;
+
+  while(position > DARY_ROOT){
+
+    parent = position/8 + 6;
+    if(key > keys[parent]){
+      keys[position] = keys[parent];
+      tasks[position] = tasks[parent];
+      tasks[position]->heap_index = position;
+      position = parent;
+    }
+    else{
+      break;
+    }
+  }
+  keys[position] = key;
+  tasks[position] = moving;
+  moving->heap_index = position;
+  return;
+}
+
+/*Moves the task at 'position' down until no child has a larger key.
+'end' is one past the last index in use.
+*/
+void dary_sift_down(unsigned int position, unsigned int end, struct thread_pool* pool){
+
+  int64_t* keys = pool->dary_keys;
+  struct task** tasks = pool->dary_tasks;
+  int64_t key = keys[position];
+  struct task* moving = tasks[position];
+  unsigned int first;
+  unsigned int child;
+
+  while(1){
+
+    first = 8*(position-6);
+    if(first >= end){
+      break;
+    }
+
+    child = first + dary_max_child(&keys[first]);
+    if(keys[child] > key){
+      keys[position] = keys[child];
+      tasks[position] = tasks[child];
+      tasks[position]->heap_index = position;
+      position = child;
+    }
+    else{
+      break;
+    }
+  }
+  keys[position] = key;
+  tasks[position] = moving;
+  moving->heap_index = position;
+  return;
+}
+
+/*As in array_heap_push_task a task that does not fit gives back the 
+count submit_task took for it.
+*/
+void dary_push_task(struct task* to_add, struct thread_pool* pool){
+
+  if(!dary_reserve(pool->num_tasks_in_queue, pool)){
+    printf("ERROR: Task was not added to the 8-ary heap\n");
+    pool->num_tasks_in_queue--;
+    to_add->queued = 0;
+    return;
+  }
+
+  unsigned int position = DARY_ROOT + pool->num_tasks_in_queue - 1;
+
+  pool->dary_keys[position] = to_add->priority;
+  pool->dary_tasks[position] = to_add;
+  dary_sift_up(position, pool);
+  return;
+}
+
+/*Returns the task at the root. The last task takes its place and is 
+sifted down. The slot it leaves goes back to INT64_MIN.
+*/
+struct task* dary_pull_task(struct thread_pool* pool){
+
+  unsigned int last = DARY_ROOT + pool->num_tasks_in_queue - 1;
+  struct task* to_return = pool->dary_tasks[DARY_ROOT];
+
+  pool->dary_keys[DARY_ROOT] = pool->dary_keys[last];
+  pool->dary_tasks[DARY_ROOT] = pool->dary_tasks[last];
+  pool->dary_keys[last] = INT64_MIN;
+
+  if(last > DARY_ROOT){
+    dary_sift_down(DARY_ROOT, last, pool);
+  }
+  return to_return;
+}
+
+/*Appends the 'n' tasks. If the batch is at least as big as the heap 
+every task with children is sifted down from the bottom up, otherwise
+each new task is sifted up.
+*/
+void dary_push_batch(struct task* to_add[], int n, struct thread_pool* pool){
+
+  unsigned int total = pool->num_tasks_in_queue;
+  unsigned int existing = total - n;
+
+  if(!dary_reserve(total, pool)){
+    printf("ERROR: Batch of %d tasks was not added to the 8-ary heap\n", n);
+    pool->num_tasks_in_queue = existing;
+    return;
+  }
+
+  for(int i=0; i<n; i++){
+    pool->dary_keys[DARY_ROOT+existing+i] = to_add[i]->priority;
+    pool->dary_tasks[DARY_ROOT+existing+i] = to_add[i];
+    to_add[i]->heap_index = DARY_ROOT+existing+i;
+  }
+
+  unsigned int end = DARY_ROOT + total;
+
+  if((unsigned int)n >= existing){
+    for(unsigned int p=(end-1)/8 + 6; p>=DARY_ROOT; p--){
+      dary_sift_down(p, end, pool);
+    }
+  }
+  else{
+    for(unsigned int p=DARY_ROOT+existing; p<end; p++){
+      dary_sift_up(p, pool);
+    }
+  }
+  return;
+}
+
+//Gives a task in the heap a new key and sifts it up or down
+void dary_update_task(struct task* to_update, int64_t priority, struct thread_pool* pool){
+
+  unsigned int end = DARY_ROOT + pool->num_tasks_in_queue;
+  unsigned int position = to_update->heap_index;
+
+  to_update->priority = priority;
+  pool->dary_keys[position] = priority;
+
+  dary_sift_up(position, pool);
+  if(pool->dary_tasks[position] == to_update){
+    dary_sift_down(position, end, pool);
+  }
+  return;
+}
+
+/*Takes 'to_remove' out of the heap. The last task fills its place and
+is sifted up or down, and the last slot goes back to INT64_MIN.
+*/
+void dary_remove_task(struct task* to_remove, struct thread_pool* pool){
+
+  unsigned int last = DARY_ROOT + pool->num_tasks_in_queue - 1;
+  unsigned int position = to_remove->heap_index;
+  struct task* moved = pool->dary_tasks[last];
+
+  pool->dary_keys[position] = pool->dary_keys[last];
+  pool->dary_tasks[position] = moved;
+  pool->dary_keys[last] = INT64_MIN;
+
+  if(position == last){
+    return;
+  }
+
+  dary_sift_up(position, pool);
+  if(pool->dary_tasks[position] == moved){
+    dary_sift_down(position, last, pool);
+  }
+  return;
+}
+
+//====================Binomial Heap Functions======================
+/*
+  For Binomial Heap functions 'pointer1' refers to the task's sibling.
+*/
+
+/*Accepts a reference to a task, 'ref_child' that is to be made into
+ a child of the task 'parent'. The child task must be the parent 
+task's rightmost child. The if ... else statement ensures this is 
+the case.
+*/ 
+void binomial_make_child(struct task** ref_child, struct task* parent){
+
+  struct task* child = (*ref_child);
+
+  //cut the child task from the root list
+  (*ref_child) = child->pointer1;
+  child->parent = parent;
+
+  if(parent->child == NULL){
+    parent->child = child;
+    child->pointer1 = NULL;
+  }
+  else{
+    struct task* prev = parent->child;
+    struct task* next = parent->child->pointer1;
+    while(next != NULL){
+      prev = prev->pointer1;
+      next = next->pointer1;
+    }
+    prev->pointer1 = child;
+    child->pointer1 = NULL;
+  }
+  parent->order++;
+
+  return;
+}
+  
+
+/*binomial_make_child compares two tasks of equal order and makes the
+lower priority task the child of the higher priority task. The two 
+tasks compared are 'curr' and 'curr->pointer1', the right sibling of 
+'curr'. The pointer to a pointer 'ref_prev' points to a pointer to 
+'curr'. This allows 'curr' to be removed from the root list if it is
+lower in priority.
+ */
+void binomial_combine(struct task** ref_prev, struct task* curr, struct thread_pool* pool){
+
+  if(task_compare(curr, curr->pointer1, pool) >= 0){
+   
+    binomial_make_child(&(curr->pointer1), curr);
+  } 
+  else{
+        binomial_make_child(ref_prev, curr->pointer1);
+  }
+  return;
+}
+
+/*merges two linked lists by order
+ 2->4->5-> and 1->3->8->
+merges to 1->2->3->4->5->8->
+*/
+struct task* binomial_simple_merge(struct task* h1, struct task* h2){
+  
+  struct task* new_head;
+
+  //reference to the pointer where the next node will be appended
+  struct task** ref_next = &new_head;
+
+  while(1){
+
+    if(h1 == NULL){
+      
+      (*ref_next) = h2;  
+      return new_head;
+    }
+    else if(h2 == NULL){
+      
+      (*ref_next) = h1;
+      return new_head;
+    }
+
+    if(h1->order <= h2->order){
+      
+      (*ref_next) = h1;
+      h1 = h1->pointer1;
+    }
+    else{
+      
+      (*ref_next) = h2;
+      h2 = h2->pointer1;
+    }
+
+    ref_next = &((*ref_next)->pointer1);
+  }
+}
+
+/*take a linked list with ascending order and  consolidate into a
+linked list that obeys the binomial heap property that every the
+linked list can only have at most one of each order task.
+For example: 1->1->4->5->5->
+will consolidate down to 2->4->6->
+*/
+struct task* binomial_consolidate(struct task* head, struct thread_pool* pool){
+
+  //keep a reference to the previous task to allow removal of curr task
+  struct task** ref_prev = &head;
+
+  struct task* curr = head;
+
+  /*there are three cases to consider as moving through linked list
+   1. curr task and curr->pointer1 have different order. In this case
+      advance curr.
+   2. curr and curr->pointer1  and curr->pointer1->pointer1 have the 
+      same order. In this case advance curr.
+   3. curr and curr->pointer1 have the same order and curr->pointer1->
+      pointer1 does not have the same order as the prev to tasks.
+      Make the lower priority of curr and curr->pointer1 the child of
+      of the higher priority task.
+  */
+  
+  while(curr->pointer1 != NULL){
+
+    //Case 1
+    if(curr->order != curr->pointer1->order){
+
+      curr = curr->pointer1;
+      ref_prev = &((*ref_prev)->pointer1);
+    }
+    else{
+      //Case 2
+      if(curr->pointer1->pointer1 != NULL && curr->pointer1->pointer1->order == curr->order){
+	
+      curr = curr->pointer1;
+      ref_prev = &((*ref_prev)->pointer1);
+      }
+      //Case 3
+      else{
+	binomial_combine(ref_prev, curr, pool);
+	curr = (*ref_prev);
+      }
+    }
+  }
+
+    return head;
+}
+
+struct task* binomial_make_union(struct task* h1, struct task* h2, struct thread_pool* pool){
+  struct task* head = binomial_simple_merge(h1, h2);  
+  head = binomial_consolidate(head, pool);
+
+  return head;
+}
+
+void binomial_push_task(struct task* to_add, struct thread_pool* pool){
+ 
+  to_add->order = 0;
+  to_add->pointer1 = NULL;
+  to_add->parent = NULL;
+  to_add->child = NULL;
+
+  if(pool->head == NULL){
+    pool->head = to_add;
+  }
+  else{
+    pool->head = binomial_make_union(pool->head, to_add, pool);
+    
+  }
+  return;
+}
+
+struct task* binomial_pull_task(struct thread_pool* pool){
+
+  struct task* highest_priority = pool->head;
+  struct task** ref_prev_high_p = &(pool->head);
+  struct task* curr = pool->head->pointer1;
+  struct task** ref_prev = &(pool->head->pointer1);
+			      
+  while(curr != NULL){
+
+    if(task_compare(curr, highest_priority, pool) > 0){
+
+      ref_prev_high_p = ref_prev;
+      highest_priority = curr;
+    }
+
+    curr = curr->pointer1;
+    ref_prev = &((*ref_prev)->pointer1);
+  }
+
+  binomial_remove_root(ref_prev_high_p, highest_priority, pool);
+
+  return highest_priority;
+}
+
+/*Cuts the root 'root' out of the root list, where 'ref_root' points to
+it, and merges its children back into the heap.
+*/
+void binomial_remove_root(struct task** ref_root, struct task* root, struct thread_pool* pool){
+
+  struct task* curr;
+
+  (*ref_root) = root->pointer1;
+
+  for(curr = root->child; curr != NULL; curr = curr->pointer1){
+    curr->parent = NULL;
+  }
+
+  if(pool->head == NULL){
+    pool->head = root->child;
+  }
+  else if(root->child != NULL){
+    pool->head = binomial_make_union(pool->head, root->child, pool);
+  }
+
+  root->pointer1 = NULL;
+  root->child = NULL;
+  root->parent = NULL;
+  return;
+}
+
+/*Links two trees of equal order. The lower priority root becomes the
+rightmost child of the other, which is returned.
+*/
+struct task* binomial_link(struct task* a, struct task* b, struct thread_pool* pool){
+
+  struct task* parent = a;
+  struct task* child = b;
+
+  if(task_compare(a, b, pool) < 0){
+    parent = b;
+    child = a;
+  }
+
+  struct task* ref = child;
+  child->pointer1 = NULL;
+  binomial_make_child(&ref, parent);
+
+  return parent;
+}
+
+/*
+Pushes 'n' tasks into the Binomial Heap at once. The batch is first 
+built into its own binomial heap the way a binary counter is 
+incremented: 'trees[k]' holds the tree of order k, and adding a task
+links equal order trees until an empty slot is found. That costs O(n)
+in total. The finished heap is then merged with pool->head in a single
+union.
+*/
+void binomial_push_batch(struct task* to_add[], int n, struct thread_pool* pool){
+
+  struct task* trees[32] = {NULL};
+  struct task* carry;
+  int k;
+
+  for(int i=0; i<n; i++){
+
+    carry = to_add[i];
+    carry->order = 0;
+    carry->pointer1 = NULL;
+    carry->parent = NULL;
+    carry->child = NULL;
+
+    k = 0;
+    while(trees[k] != NULL){
+      carry = binomial_link(trees[k], carry, pool);
+      trees[k] = NULL;
+      k++;
+    }
+    trees[k] = carry;
+  }
+
+  //the root list is kept in ascending order
+  struct task* batch = NULL;
+  struct task** ref_next = &batch;
+  for(k=0; k<32; k++){
+    if(trees[k] != NULL){
+      (*ref_next) = trees[k];
+      ref_next = &(trees[k]->pointer1);
+    }
+  }
+  (*ref_next) = NULL;
+
+  if(pool->head == NULL){
+    pool->head = batch;
+  }
+  else{
+    pool->head = binomial_make_union(pool->head, batch, pool);
+  }
+  return;
+}
+
+/*Exchanges the places of 'child' and its parent in the tree. As with
+binary_swap the tasks are relinked rather than having their contents 
+swapped. The pointers to each of them are found by walking the sibling
+lists, which hold at most one task of each order.
+*/
+void binomial_swap(struct task* child, struct thread_pool* pool){
+
+  struct task* parent = child->parent;
+  struct task* grandchildren = child->child;
+  struct task* next = child->pointer1;
+  int order = child->order;
+  struct task** ref_parent;
+  struct task** ref_child = &(parent->child);
+  struct task* curr;
+
+  if(parent->parent == NULL){
+    ref_parent = &(pool->head);
+  }
+  else{
+    ref_parent = &(parent->parent->child);
+  }
+  while((*ref_parent) != parent){
+    ref_parent = &((*ref_parent)->pointer1);
+  }
+  while((*ref_child) != child){
+    ref_child = &((*ref_child)->pointer1);
+  }
+
+  //child takes the place of parent and parent the place of child
+  //among its children
+  (*ref_parent) = child;
+  child->parent = parent->parent;
+  child->pointer1 = parent->pointer1;
+  child->order = parent->order;
+  (*ref_child) = parent;
+  child->child = parent->child;
+
+  parent->pointer1 = next;
+  parent->child = grandchildren;
+  parent->order = order;
+
+  for(curr = child->child; curr != NULL; curr = curr->pointer1){
+    curr->parent = child;
+  }
+  for(curr = parent->child; curr != NULL; curr = curr->pointer1){
+    curr->parent = parent;
+  }
+  return;
+}
+
+/*Gives a task in the heap a new priority. It is swapped with its 
+parent while it beats it, or else with its highest priority child 
+while that beats it. The root list is not ordered so only the tree the
+task is in changes.
+*/
+void binomial_update_task(struct task* to_update, int64_t priority, struct thread_pool* pool){
+
+  struct task* high_child;
+  struct task* curr;
+
+  to_update->priority = priority;
+
+  if(to_update->parent != NULL && task_compare(to_update, to_update->parent, pool) > 0){
+
+    while(to_update->parent != NULL && task_compare(to_update, to_update->parent, pool) > 0){
+      binomial_swap(to_update, pool);
+    }
+    return;
+  }
+
+  while(1){
+
+    high_child = to_update->child;
+    if(high_child == NULL){
+      break;
+    }
+    for(curr = high_child->pointer1; curr != NULL; curr = curr->pointer1){
+      if(task_compare(curr, high_child, pool) > 0){
+	high_child = curr;
+      }
+    }
+
+    if(task_compare(high_child, to_update, pool) > 0){
+      binomial_swap(high_child, pool);
+    }
+    else{
+      break;
+    }
+  }
+  return;
+}
+
+/*Takes 'to_remove' out of the heap. It is swapped up to the root of 
+its tree as if it had the highest priority, and that root is then 
+removed the same way binomial_pull_task removes one.
+*/
+void binomial_remove_task(struct task* to_remove, struct thread_pool* pool){
+
+  struct task** ref_root = &(pool->head);
+
+  while(to_remove->parent != NULL){
+    binomial_swap(to_remove, pool);
+  }
+  while((*ref_root) != to_remove){
+    ref_root = &((*ref_root)->pointer1);
+  }
+
+  binomial_remove_root(ref_root, to_remove, pool);
+  return;
+}
+
+
+//====================Lazy Binomial Heap Functions=================
+/*
+  The same trees as the Binomial Heap, but a push only adds the task to
+  the front of the root list, so the list can hold any number of trees
+  of each order. They are linked into at most one of each order when a
+  task is pulled, the only time the heap has to be in order. 
+  'pointer1' refers to the task's sibling, as in the Binomial Heap, and
+  a tree's children are kept newest first so a link is O(1). 
+  pool->lazy_max caches the highest priority root, so the root list is
+  not scanned to find it. binomial_swap walks the root list when it 
+  moves a root, so update and remove consolidate it first.
+*/
+
+/*Makes the lower priority of the two trees of equal order the first
+child of the other, which is returned.
+*/
+struct task* lazy_binomial_link(struct task* a, struct task* b, struct thread_pool* pool){
+
+  struct task* parent = a;
+  struct task* child = b;
+
+  if(task_compare(a, b, pool) < 0){
+    parent = b;
+    child = a;
+  }
+
+  child->parent = parent;
+  child->pointer1 = parent->child;
+  parent->child = child;
+  parent->order++;
+
+  return parent;
+}
+
+/*
+  Links every root except 'removed', followed by the children of 
+  'removed' if it is not NULL, into at most one tree of each order. 
+  pool->degree_table holds the tree of each order found so far, as in
+  fibonacci_consolidate, and is left all NULL. The root list is then
+  rebuilt from the table and the highest priority root cached again.
+*/
+void lazy_binomial_consolidate(struct task* removed, struct thread_pool* pool){
+
+  struct task** table = pool->degree_table;
+  struct task* curr = pool->head;
+  struct task* children = NULL;
+  struct task* next;
+  int length = 0;
+  int order;
+
+  if(removed != NULL){
+    children = removed->child;
+  }
+
+  while(curr != NULL || children != NULL){
+
+    if(curr == NULL){
+      curr = children;
+      children = NULL;
+    }
+    next = curr->pointer1;
+
+    if(curr != removed){
+
+      curr->parent = NULL;
+      order = curr->order;
+      while(table[order] != NULL){
+	curr = lazy_binomial_link(curr, table[order], pool);
+	table[order] = NULL;
+	order++;
+      }
+      table[order] = curr;
+      if(order >= length){
+	length = order+1;
+      }
+    }
+    curr = next;
+  }
+
+  pool->head = NULL;
+  pool->lazy_max = NULL;
+  for(int i=length-1; i>=0; i--){
+
+    if(table[i] != NULL){
+      table[i]->pointer1 = pool->head;
+      pool->head = table[i];
+      if(pool->lazy_max == NULL || task_compare(table[i], pool->lazy_max, pool) > 0){
+	pool->lazy_max = table[i];
+      }
+      table[i] = NULL;
+    }
+  }
+  return;
+}
+
+void lazy_binomial_push_task(struct task* to_add, struct thread_pool* pool){
+
+  to_add->order = 0;
+  to_add->parent = NULL;
+  to_add->child = NULL;
+  to_add->pointer1 = pool->head;
+  pool->head = to_add;
+
+  if(pool->lazy_max == NULL || task_compare(to_add, pool->lazy_max, pool) > 0){
+    pool->lazy_max = to_add;
+  }
+  return;
+}
+
+//Returns the cached highest priority root and consolidates the rest
+struct task* lazy_binomial_pull_task(struct thread_pool* pool){
+
+  struct task* to_return = pool->lazy_max;
+
+  lazy_binomial_consolidate(to_return, pool);
+
+  to_return->pointer1 = NULL;
+  to_return->child = NULL;
+  to_return->parent = NULL;
+  return to_return;
+}
+
+/*Moves the task within its tree like binomial_update_task once the 
+roots are consolidated, which leaves at most one root of each order
+for binomial_swap to walk. A task that now beats the cached root takes
+its place. If the cached root itself went down the roots are 
+consolidated again to find the new one.
+*/
+void lazy_binomial_update_task(struct task* to_update, int64_t priority, struct thread_pool* pool){
+
+  //taken first since with comp_function the key has already changed
+  int was_highest = (to_update == pool->lazy_max);
+
+  if(to_update->parent != NULL || to_update->child != NULL){
+    lazy_binomial_consolidate(NULL, pool);
+  }
+
+  binomial_update_task(to_update, priority, pool);
+
+  if(was_highest){
+    lazy_binomial_consolidate(NULL, pool);
+  }
+  else if(to_update->parent == NULL && task_compare(to_update, pool->lazy_max, pool) > 0){
+    pool->lazy_max = to_update;
+  }
+  return;
+}
+
+/*Swaps 'to_remove' up to the root of its tree and then removes it the
+way lazy_binomial_pull_task removes the cached root. The roots are 
+consolidated first, as in lazy_binomial_update_task.
+*/
+void lazy_binomial_remove_task(struct task* to_remove, struct thread_pool* pool){
+
+  if(to_remove->parent != NULL){
+    lazy_binomial_consolidate(NULL, pool);
+  }
+  while(to_remove->parent != NULL){
+    binomial_swap(to_remove, pool);
+  }
+
+  lazy_binomial_consolidate(to_remove, pool);
+
+  to_remove->pointer1 = NULL;
+  to_remove->child = NULL;
+  to_remove->parent = NULL;
+  return;
+}
+
+
+//====================Fibonacci Heap Functions=====================
+
+/*
+  For Fibonacci Heap functions 'pointer1' refers to the task's left
+  child pointer and 'pointer2' refers to the right child pointer.
+*/
+
+
+/*
+  Makes task 'b' into a child of task 'a'. If 'a' has children 'b'
+  will be spliced into the child list.
+*/
+struct task* fibonacci_make_child(struct task* a, struct task* b, struct thread_pool* pool){
+
+  //remove b from root list
+  struct task* left_neighbor = b->pointer1;
+  struct task* right_neighbor = b->pointer2;
+
+  if(a->child == NULL){
+    a->child = b;
+    b->pointer1 = b;
     b->pointer2 = b;
   }
   else{
-    right_neighbor = a->child;
-    left_neighbor = right_neighbor->pointer1;
-    left_neighbor->pointer2 = b;
-    b->pointer1 = left_neighbor;
-    right_neighbor->pointer1 = b;
-    b->pointer2 = right_neighbor;
+    right_neighbor = a->child;
+    left_neighbor = right_neighbor->pointer1;
+    left_neighbor->pointer2 = b;
+    b->pointer1 = left_neighbor;
+    right_neighbor->pointer1 = b;
+    b->pointer2 = right_neighbor;
+  }
+  b->parent = a;
+  b->marked = 0;
+  a->degree++;
+  return a;
+}
+
+/*
+  Relink the tasks pointed to by 'ptrs' into a doubly linked list.
+  Return the highest priority task. 'ptrs' is left all NULL for the
+  next consolidation.
+*/
+struct task* fibonacci_relink(struct task* ptrs[], int length, struct thread_pool* pool){
+  
+  struct task* high_priority = NULL;
+  
+  struct task* left_head = NULL;
+  struct task** work_right_ref = &left_head;
+  for(int i=0; i<length; i++){
+
+    if(ptrs[i] != NULL){
+      if(high_priority == NULL || task_compare(ptrs[i], high_priority, pool) > 0){
+	high_priority = ptrs[i];
+      }
+      (*work_right_ref) = ptrs[i];
+      work_right_ref = &((*work_right_ref)->pointer2);
+    }
+  }
+  
+  struct task* right_head = NULL;
+  struct task** work_left_ref = &right_head;
+  for(int i=length-1; i>=0; i--){
+
+    if(ptrs[i] != NULL){
+      (*work_left_ref) = ptrs[i];
+      work_left_ref = &((*work_left_ref)->pointer1);
+      ptrs[i] = NULL;
+    }
+  }
+
+  (*work_right_ref) = left_head;
+  (*work_left_ref) = right_head;
+
+  return high_priority;
+}
+
+/*
+  The work of preserving the properties of the fibonacci heap is 
+  deferred until a task is removed. At that point nodes of the same
+  degree must be consolidated until there is only one node of each
+  degree. To accomplish this the array of pointers 
+  pool->degree_table, 'ptrs', is used. ptrs[0] points to a task
+  with degree '0'. ptrs[1] points to a task with degree '1' etc. Step
+  through the root list and link each task to the appropriate indice
+  of array 'ptrs'. If that indice of 'ptrs' already points to a task
+  make the lower priority task into a child of the higher priority 
+  task.
+  When the whole root list has been stepped through relink the tasks
+  pointed to by 'ptrs' into a doubly linked list.
+  Track the highest priority node and set pool->head to it.
+  The array stays in the pool and is all NULL between consolidations.
+  Only the degrees up to the highest one reached are relinked, and 
+  cleared on the way, so the amortized cost of a pull is O(log n) 
+  rather than the size of the queue.
+*/
+void fibonacci_consolidate(struct thread_pool* pool){
+
+  struct task** ptrs = pool->degree_table;
+  int length = 0;
+
+  struct task* x = pool->head;
+  struct task* y;
+  int degree;
+
+  //break the continuous linked list
+  x->pointer1->pointer2 = NULL;
+
+  while(x != NULL){
+
+    degree = x->degree;
+
+    while(ptrs[degree] != NULL){
+      y = ptrs[degree];
+      if(task_compare(x, y, pool) >= 0){
+	x = fibonacci_make_child(x,y,pool);
+      }
+      else{
+	y->pointer2 = x->pointer2;
+	y = fibonacci_make_child(y,x,pool);
+	x = y;
+      }
+      ptrs[degree] = NULL;
+      degree++;
+    }
+    ptrs[degree] = x;
+    if(degree >= length){
+      length = degree+1;
+    }
+    x=x->pointer2;
+  }
+
+  //relink into doubly linked list
+  pool->head = fibonacci_relink(ptrs, length, pool);
+  
+  return;
+}
+
+//splices task 'b' and siblings into root list with 'a'
+void fibonacci_splice(struct task* a, struct task* b){
+
+  struct task* left_end = b;
+  struct task* right_end = left_end->pointer1;
+
+  //insert into root list
+  struct task* right_neighbor = a->pointer2;
+  a->pointer2 = left_end;
+  left_end->pointer1 =a;
+  right_neighbor->pointer1 = right_end;
+  right_end->pointer2 = right_neighbor;
+
+  return;
+}
+  
+/*
+  Sets the parent pointer of 'a' and all of the siblings of 'a' to
+  NULL
+*/
+void fibonacci_set_parent_null(struct task* a){
+
+  struct task* left_end = a;
+  struct task* stop = left_end;
+  do{
+    left_end->parent = NULL;
+    left_end = left_end->pointer2;
+  }while(left_end != stop);
+
+  return;
+}
+
+//unsplice 'a' from root list
+void fibonacci_unsplice(struct task* a){
+
+  struct task* right_neighbor = a->pointer2;
+  struct task* left_neighbor = a->pointer1;
+  right_neighbor->pointer1 = left_neighbor;
+  left_neighbor->pointer2 = right_neighbor;
+  return;
+}
+
+/*
+  Adds a task to the fibonacci heap. Simply splices the task into the
+  root list. Updates pool->head if the task just added is the highest
+  priority task.
+*/
+void fibonacci_push_task(struct task* to_add, struct thread_pool* pool){
+
+  to_add->pointer1 = to_add;
+  to_add->pointer2 = to_add;
+  to_add->parent = NULL;
+  to_add->child = NULL;
+  to_add->degree = 0;
+  to_add->marked = 0;
+
+  if(pool->head == NULL){
+
+    pool->head = to_add;
+  }
+  else{
+    
+    fibonacci_splice(pool->head, to_add);
+
+    if(task_compare(to_add, pool->head, pool) > 0){
+      pool->head = to_add;
+    }
+  }
+
+  return;
+}
+
+/*
+  Adds 'n' tasks to the fibonacci heap at once. The tasks are linked
+  into their own circular list and that list is spliced into the root
+  list in one step. pool->head moves to the highest priority task if
+  it is in the batch.
+*/
+void fibonacci_push_batch(struct task* to_add[], int n, struct thread_pool* pool){
+
+  struct task* high_priority = to_add[0];
+  struct task* curr;
+
+  for(int i=0; i<n; i++){
+
+    curr = to_add[i];
+    curr->pointer1 = to_add[(i+n-1)%n];
+    curr->pointer2 = to_add[(i+1)%n];
+    curr->parent = NULL;
+    curr->child = NULL;
+    curr->degree = 0;
+    curr->marked = 0;
+
+    if(task_compare(curr, high_priority, pool) > 0){
+      high_priority = curr;
+    }
+  }
+
+  if(pool->head == NULL){
+    pool->head = high_priority;
+  }
+  else{
+
+    fibonacci_splice(pool->head, to_add[0]);
+
+    if(task_compare(high_priority, pool->head, pool) > 0){
+      pool->head = high_priority;
+    }
+  }
+  return;
+}
+
+struct task* fibonacci_pull_task(struct thread_pool* pool){
+
+  if(pool->head == NULL){
+    return NULL;
+  }
+  
+  struct task* to_return = pool->head;
+
+  //if they exist promote the children of node to be
+  //removed to the root list
+  if(to_return->child != NULL){
+
+    fibonacci_set_parent_null(to_return->child);
+    fibonacci_splice(to_return, to_return->child);
+  }
+
+  if(to_return->pointer2 == to_return){
+    pool->head = NULL;
+  }
+  else{
+
+    //update head
+    pool->head = to_return->pointer1;
+    
+    //remove to_return
+    fibonacci_unsplice(to_return);
+
+    fibonacci_consolidate(pool);
+  }
+  return to_return;
+
+}
+
+/*
+  Cuts 'to_cut' and its subtree from its parent and splices it into
+  the root list.
+*/
+void fibonacci_cut(struct task* to_cut, struct thread_pool* pool){
+
+  struct task* parent = to_cut->parent;
+
+  if(to_cut->pointer2 == to_cut){
+    parent->child = NULL;
+  }
+  else{
+    if(parent->child == to_cut){
+      parent->child = to_cut->pointer2;
+    }
+    fibonacci_unsplice(to_cut);
+  }
+  parent->degree--;
+
+  to_cut->pointer1 = to_cut;
+  to_cut->pointer2 = to_cut;
+  to_cut->parent = NULL;
+  to_cut->marked = 0;
+  fibonacci_splice(pool->head, to_cut);
+  return;
+}
+
+/*
+  Called on a task that just lost a child. The first time a child is
+  lost the task is only marked. The second time it is cut as well and
+  its own parent has lost a child, and so on up the tree. This keeps 
+  the trees bushy enough that a task of degree k still has a number
+  of descendants exponential in k.
+*/
+void fibonacci_cascading_cut(struct task* parent, struct thread_pool* pool){
+
+  struct task* next;
+
+  while(parent->parent != NULL){
+
+    if(parent->marked == 0){
+      parent->marked = 1;
+      return;
+    }
+    next = parent->parent;
+    fibonacci_cut(parent, pool);
+    parent = next;
+  }
+  return;
+}
+
+/*
+  Gives a task in the heap a new priority. If it now beats its parent
+  it is cut to the root list, the Fibonacci Heap's decrease-key in a 
+  max heap. Otherwise any children that now beat it are cut instead. 
+  If the task was pool->head it may no longer be the highest priority
+  root, so the root list is consolidated to find the new head.
+*/
+void fibonacci_update_task(struct task* to_update, int64_t priority, struct thread_pool* pool){
+
+  struct task* parent = to_update->parent;
+  struct task* child = to_update->child;
+  struct task* next;
+
+  to_update->priority = priority;
+
+  if(parent != NULL && task_compare(to_update, parent, pool) > 0){
+
+    fibonacci_cut(to_update, pool);
+    fibonacci_cascading_cut(parent, pool);
+  }
+  else{
+
+    for(int i=to_update->degree; i>0; i--){
+
+      next = child->pointer2;
+      if(task_compare(child, to_update, pool) > 0){
+	fibonacci_cut(child, pool);
+	fibonacci_cascading_cut(to_update, pool);
+      }
+      child = next;
+    }
   }
-  b->parent = a;
-  a->degree++;
+
+  if(to_update == pool->head){
+    fibonacci_consolidate(pool);
+  }
+  else if(to_update->parent == NULL && task_compare(to_update, pool->head, pool) > 0){
+    pool->head = to_update;
+  }
+  return;
+}
+
+/*
+  Takes 'to_remove' out of the heap. It is cut to the root list as if
+  its priority had gone up past every other, made pool->head, and then
+  pulled.
+*/
+void fibonacci_remove_task(struct task* to_remove, struct thread_pool* pool){
+
+  struct task* parent = to_remove->parent;
+
+  if(parent != NULL){
+    fibonacci_cut(to_remove, pool);
+    fibonacci_cascading_cut(parent, pool);
+  }
+
+  pool->head = to_remove;
+  fibonacci_pull_task(pool);
+  return;
+}
+
+//====================FIFO Functions===============================
+
+/*
+  For First In First Out functions 'pointer1' refers to the task's 
+  newer sibling and 'pointer2' refers older sibling.
+*/
+
+void FIFO_push_task(struct task* to_add, struct thread_pool* pool){
+
+  if(pool->head == NULL){
+    pool->head = to_add;
+    to_add->pointer1 = NULL;
+    pool->tail = to_add;
+    to_add->pointer2 = NULL;
+  }
+  else{
+    to_add->pointer2 = pool->tail;
+    to_add->pointer1 = NULL;
+    pool->tail->pointer1 = to_add;
+    pool->tail = to_add;
+  }
+  return;
+  
+}
+
+struct task* FIFO_pull_task(struct thread_pool* pool){
+  
+  struct task* to_return = pool->head;
+
+  pool->head = pool->head->pointer1;
+
+  //Just dequeued the only element in linked list
+  if(pool->head == NULL){
+    pool->tail = NULL;
+  }
+  else{
+    pool->head->pointer2 = NULL;
+  }
+
+  return to_return;
+}
+
+//Unlinks 'to_remove' from between its older and newer siblings
+void FIFO_remove_task(struct task* to_remove, struct thread_pool* pool){
+
+  if(to_remove->pointer2 == NULL){
+    pool->head = to_remove->pointer1;
+  }
+  else{
+    to_remove->pointer2->pointer1 = to_remove->pointer1;
+  }
+
+  if(to_remove->pointer1 == NULL){
+    pool->tail = to_remove->pointer2;
+  }
+  else{
+    to_remove->pointer1->pointer2 = to_remove->pointer2;
+  }
+  return;
+}
+
+//====================LIFO Functions===============================
+
+/*
+  For Last In First Out functions 'pointer1' refers to the next 
+  task in line for execution and 'pointer2' to the task added after
+  it, so a task can be unlinked from the middle.
+*/
+
+
+void LIFO_push_task(struct task* to_add, struct thread_pool* pool){
+
+  struct task* temp = pool->head;
+  pool->head = to_add;
+  to_add->pointer1 = temp;
+  to_add->pointer2 = NULL;
+  if(temp != NULL){
+    temp->pointer2 = to_add;
+  }
+  return;
+}
+
+struct task* LIFO_pull_task(struct thread_pool* pool){
+
+  if(pool->head == NULL){
+    printf("ERROR: Attempted to remove task when no task is in queue.");
+    return NULL;
+  }
+
+  struct task* to_return = pool->head;
+  pool->head = to_return->pointer1;
+  if(pool->head != NULL){
+    pool->head->pointer2 = NULL;
+  }
+
+  return to_return;
+}
+
+void LIFO_remove_task(struct task* to_remove, struct thread_pool* pool){
+
+  if(to_remove->pointer2 == NULL){
+    pool->head = to_remove->pointer1;
+  }
+  else{
+    to_remove->pointer2->pointer1 = to_remove->pointer1;
+  }
+
+  if(to_remove->pointer1 != NULL){
+    to_remove->pointer1->pointer2 = to_remove->pointer2;
+  }
+  return;
+}
+
+//====================Work Stealing Functions======================
+
+/*
+  Each thread owns a Chase-Lev deque. The owner pushes and pops at the
+  bottom without locking. Idle threads steal from the top of another
+  thread's deque. Tasks added by a thread that is not part of the pool
+  are placed on an inbox belonging to one of the threads, chosen round
+  robin. An inbox is drained into its owner's deque in one step.
+
+  For inbox functions 'pointer1' refers to the next task in the inbox.
+*/
+
+#define WS_INITIAL_SIZE 64
+
+struct ws_array* ws_array_create(long size){
+
+  struct ws_array* a = malloc(sizeof(struct ws_array) + size*sizeof(struct task*));
+
+  if(a == NULL){
+    printf("ERROR: Could not allocate work stealing deque\n");
+    return NULL;
+  }
+
+  a->size = size;
+  a->prev = NULL;
   return a;
 }
 
+//Returns 0 if the first buffer could not be allocated
+int ws_deque_init(struct ws_deque* q){
+
+  struct ws_array* a = ws_array_create(WS_INITIAL_SIZE);
+
+  atomic_init(&q->top, 0);
+  atomic_init(&q->bottom, 0);
+  atomic_init(&q->array, a);
+  return (a != NULL);
+}
+
+//frees the current buffer and every buffer it replaced
+void ws_deque_free(struct ws_deque* q){
+
+  struct ws_array* a = atomic_load_explicit(&q->array, memory_order_relaxed);
+  struct ws_array* temp;
+
+  while(a != NULL){
+    temp = a;
+    a = a->prev;
+    free(temp);
+  }
+  return;
+}
+
+/*
+  Only called by the owner. If the buffer is full the live tasks 
+  between 'top' and 'bottom' are copied into a buffer twice the size.
+  Returns 0, leaving the deque as it was, if that buffer could not be
+  allocated.
+*/
+int ws_deque_push(struct ws_deque* q, struct task* to_add){
+
+  long b = atomic_load_explicit(&q->bottom, memory_order_relaxed);
+  long t = atomic_load_explicit(&q->top, memory_order_acquire);
+  struct ws_array* a = atomic_load_explicit(&q->array, memory_order_relaxed);
+
+  if(b - t > a->size - 1){
+
+    struct ws_array* bigger = ws_array_create(2*a->size);
+    if(bigger == NULL){
+      return 0;
+    }
+    for(long i=t; i<b; i++){
+      struct task* x = atomic_load_explicit(&a->buffer[i&(a->size-1)], memory_order_relaxed);
+      atomic_store_explicit(&bigger->buffer[i&(bigger->size-1)], x, memory_order_relaxed);
+    }
+    bigger->prev = a;
+    atomic_store_explicit(&q->array, bigger, memory_order_release);
+    a = bigger;
+  }
+
+  atomic_store_explicit(&a->buffer[b&(a->size-1)], to_add, memory_order_relaxed);
+  atomic_store_explicit(&q->bottom, b+1, memory_order_release);
+  return 1;
+}
+
+/*
+  Only called by the owner. Removes the newest task. When a single task
+  remains the owner races the thieves for it on 'top'. Returns NULL if
+  the deque is empty.
+*/
+struct task* ws_deque_take(struct ws_deque* q){
+
+  long b = atomic_load_explicit(&q->bottom, memory_order_relaxed) - 1;
+  struct ws_array* a = atomic_load_explicit(&q->array, memory_order_relaxed);
+  atomic_store_explicit(&q->bottom, b, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  long t = atomic_load_explicit(&q->top, memory_order_relaxed);
+
+  struct task* x = NULL;
+
+  if(t <= b){
+
+    x = atomic_load_explicit(&a->buffer[b&(a->size-1)], memory_order_relaxed);
+
+    if(t == b){
+      //last task. Whoever moves 'top' first gets it
+      if(!atomic_compare_exchange_strong_explicit(&q->top, &t, t+1, memory_order_seq_cst, memory_order_relaxed)){
+	x = NULL;
+      }
+      atomic_store_explicit(&q->bottom, b+1, memory_order_relaxed);
+    }
+  }
+  else{
+    atomic_store_explicit(&q->bottom, b+1, memory_order_relaxed);
+  }
+
+  return x;
+}
+
+/*
+  Removes the oldest task from 'q'. May be called by any thread.
+  Returns 1 and sets 'stolen' on success, 0 if the deque is empty, and
+  -1 if another thread took the task first. On -1 the caller should 
+  try again.
+*/
+int ws_deque_steal(struct ws_deque* q, struct task** stolen){
+
+  long t = atomic_load_explicit(&q->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  long b = atomic_load_explicit(&q->bottom, memory_order_acquire);
+
+  if(t >= b){
+    return 0;
+  }
+
+  struct ws_array* a = atomic_load_explicit(&q->array, memory_order_acquire);
+  struct task* x = atomic_load_explicit(&a->buffer[t&(a->size-1)], memory_order_relaxed);
+
+  if(!atomic_compare_exchange_strong_explicit(&q->top, &t, t+1, memory_order_seq_cst, memory_order_relaxed)){
+    return -1;
+  }
+
+  (*stolen) = x;
+  return 1;
+}
+
+//appends 'to_add' to the inbox of 'worker'
+void ws_inbox_push(struct thread_info* worker, struct task* to_add){
+
+  to_add->pointer1 = NULL;
+
+  pthread_mutex_lock(&worker->inbox_lock);
+
+  if(worker->inbox_head == NULL){
+    worker->inbox_head = to_add;
+  }
+  else{
+    worker->inbox_tail->pointer1 = to_add;
+  }
+  worker->inbox_tail = to_add;
+
+  pthread_mutex_unlock(&worker->inbox_lock);
+  return;
+}
+
+//appends the 'n' tasks in 'to_add' to the inbox of 'worker' in order
+void ws_inbox_push_many(struct thread_info* worker, struct task* to_add[], int n){
+
+  for(int i=0; i<n-1; i++){
+    to_add[i]->pointer1 = to_add[i+1];
+  }
+  to_add[n-1]->pointer1 = NULL;
+
+  pthread_mutex_lock(&worker->inbox_lock);
+
+  if(worker->inbox_head == NULL){
+    worker->inbox_head = to_add[0];
+  }
+  else{
+    worker->inbox_tail->pointer1 = to_add[0];
+  }
+  worker->inbox_tail = to_add[n-1];
+
+  pthread_mutex_unlock(&worker->inbox_lock);
+  return;
+}
+
+/*removes the oldest task in the inbox of 'worker'. NULL if empty.
+The inbox is checked before taking the lock so that empty inboxes cost
+a single load.
+*/
+struct task* ws_inbox_take_one(struct thread_info* worker){
+
+  if(worker->inbox_head == NULL){
+    return NULL;
+  }
+
+  pthread_mutex_lock(&worker->inbox_lock);
+
+  struct task* to_return = worker->inbox_head;
+  if(to_return != NULL){
+    worker->inbox_head = to_return->pointer1;
+    if(worker->inbox_head == NULL){
+      worker->inbox_tail = NULL;
+    }
+  }
+
+  pthread_mutex_unlock(&worker->inbox_lock);
+  return to_return;
+}
+
+/*
+  Moves every task in the owner's inbox onto the owner's deque, oldest
+  first. If the deque can not grow the tasks left are put back at the 
+  front of the inbox. Returns the number of tasks moved.
+*/
+int ws_inbox_drain(struct thread_info* worker){
+
+  if(worker->inbox_head == NULL){
+    return 0;
+  }
+
+  pthread_mutex_lock(&worker->inbox_lock);
+  struct task* curr = worker->inbox_head;
+  worker->inbox_head = NULL;
+  worker->inbox_tail = NULL;
+  pthread_mutex_unlock(&worker->inbox_lock);
+
+  int moved = 0;
+  struct task* next;
+  while(curr != NULL){
+    next = curr->pointer1;
+    if(!ws_deque_push(&worker->deque, curr)){
+      break;
+    }
+    curr = next;
+    moved++;
+  }
+
+  if(curr != NULL){
+
+    struct task* last = curr;
+    while(last->pointer1 != NULL){
+      last = last->pointer1;
+    }
+
+    pthread_mutex_lock(&worker->inbox_lock);
+    last->pointer1 = worker->inbox_head;
+    if(worker->inbox_head == NULL){
+      worker->inbox_tail = last;
+    }
+    worker->inbox_head = curr;
+    pthread_mutex_unlock(&worker->inbox_lock);
+  }
+  return moved;
+}
+
+/*
+  Visits every thread in the pool starting from a random one and tries
+  to steal the oldest task from its deque, then from its inbox. Threads
+  that have left the pool are visited too since tasks may have been 
+  placed on their inbox as they left.
+  Returns NULL if nothing could be found.
+*/
+struct task* ws_steal_task(struct thread_pool* pool, struct thread_info* self){
+
+  struct thread_info* head = atomic_load(&pool->thread_list);
+  struct thread_info* victim = head;
+  struct thread_info* start;
+  struct task* stolen;
+
+  if(head == NULL){
+    return NULL;
+  }
+
+  //xorshift to pick the starting victim
+  unsigned int x = self->seed;
+  x ^= x<<13;
+  x ^= x>>17;
+  x ^= x<<5;
+  self->seed = x;
+
+  int skip = x%(pool->number_threads > 0 ? pool->number_threads : 1);
+  for(int i=0; i<skip; i++){
+    victim = (victim->next != NULL) ? victim->next : head;
+  }
+
+  start = victim;
+  do{
+
+    if(victim != self){
+
+      int result;
+      do{
+	result = ws_deque_steal(&victim->deque, &stolen);
+      }while(result == -1);
+
+      if(result == 1){
+	return stolen;
+      }
+
+      stolen = ws_inbox_take_one(victim);
+      if(stolen != NULL){
+	return stolen;
+      }
+    }
+
+    victim = (victim->next != NULL) ? victim->next : head;
+  }while(victim != start);
+
+  return NULL;
+}
+
 /*
-  Relink the tasks pointed to by 'ptrs' into a doubly linked list.
-  Return the highest priority task.
+  A thread of the pool pushes onto its own deque. Any other thread
+  places the task on the inbox of the next thread in round robin order.
+  If the pool has no threads yet the task is held on pool->head until
+  add_threads is called.
 */
-struct task* fibonacci_relink(struct task* ptrs[], int length, struct thread_pool* pool){
-  
-  struct task* high_priority = NULL;
-  
-  struct task* left_head = NULL;
-  struct task** work_right_ref = &left_head;
-  for(int i=0; i<length; i++){
+void ws_push_task(struct task* to_add, struct thread_pool* pool){
 
-    if(ptrs[i] != NULL){
-      if(high_priority == NULL || pool->comp_function(ptrs[i]->arg, high_priority->arg) > 0){
-	high_priority = ptrs[i];
-      }
-      (*work_right_ref) = ptrs[i];
-      work_right_ref = &((*work_right_ref)->pointer2);
+  struct thread_info* self = current_worker;
+
+  //a deque that can not grow leaves the task on the thread's inbox
+  if(self != NULL && self->pool == pool){
+    if(!ws_deque_push(&self->deque, to_add)){
+      ws_inbox_push(self, to_add);
     }
+    return;
   }
-  
-  struct task* right_head = NULL;
-  struct task** work_left_ref = &right_head;
-  for(int i=length-1; i>=0; i--){
 
-    if(ptrs[i] != NULL){
-      (*work_left_ref) = ptrs[i];
-      work_left_ref = &((*work_left_ref)->pointer1);
+  struct thread_info* target = atomic_load(&pool->inbox_cursor);
+
+  if(target == NULL){
+
+    //recheck while add_threads cannot run
+    pthread_mutex_lock(&pool->modify_pool);
+    target = atomic_load(&pool->inbox_cursor);
+    if(target == NULL){
+      FIFO_push_task(to_add, pool);
+      pthread_mutex_unlock(&pool->modify_pool);
+      return;
     }
+    pthread_mutex_unlock(&pool->modify_pool);
   }
 
-  (*work_right_ref) = left_head;
-  (*work_left_ref) = right_head;
+  atomic_store_explicit(&pool->inbox_cursor, ws_next_inbox(pool, target), memory_order_relaxed);
 
-  return high_priority;
+  ws_inbox_push(target, to_add);
+  return;
 }
 
 /*
-  The work of preserving the properties of the fibonacci heap is 
-  deferred until a task is removed. At that point nodes of the same
-  degree must be consolidated until there is only one node of each
-  degree. To accomplish this an array of pointers is created, 'ptrs'.
-  ptrs[0] points to a task with degree '0'. ptrs[1] points to a task
-  with degree '1' etc. Step through the root list and link each task
-  to the appropriate indice of array 'ptrs'. If that indice of 'ptrs'
-  already points to a task make the lower priority task into a child
-  of the higher priority task.
-  When the whole root list has been stepped through relink the tasks
-  pointed to by 'ptrs' into a doubly linked list.
-  Track the highest priority node and set pool->head to it
+  Returns the thread after 'target' on thread_list that has not left 
+  the pool, or 'target' if there is none.
 */
-void fibonacci_consolidate(struct thread_pool* pool){
+struct thread_info* ws_next_inbox(struct thread_pool* pool, struct thread_info* target){
 
-  int length = 2;
-  while(length < pool->num_tasks_in_queue){
-    length = length*2;
-  }
-    
-  struct task* ptrs[length];
-  for(int i=0; i<length; i++){
-    ptrs[i] = NULL;
-  }
+  struct thread_info* next = target;
 
-  struct task* x = pool->head;
-  struct task* y;
-  int degree;
+  do{
+    next = next->next;
+    if(next == NULL){
+      next = atomic_load(&pool->thread_list);
+    }
+  }while(next != target && atomic_load_explicit(&next->state, memory_order_relaxed) != THREAD_RUNNING);
 
-  //break the continuous linked list
-  x->pointer1->pointer2 = NULL;
+  return next;
+}
 
-  while(x != NULL){
+/*
+  A thread of the pool pushes the whole batch onto its own deque. Any
+  other thread splits the batch into one run per thread and hands each
+  run to the next inbox in round robin order, taking each inbox lock
+  once.
+*/
+void ws_push_batch(struct task* to_add[], int n, struct thread_pool* pool){
 
-    degree = x->degree;
+  struct thread_info* self = current_worker;
 
-    while(ptrs[degree] != NULL){
-      y = ptrs[degree];
-      if(pool->comp_function(x->arg,y->arg) >= 0){
-	x = fibonacci_make_child(x,y,pool);
-      }
-      else{
-	y->pointer2 = x->pointer2;
-	y = fibonacci_make_child(y,x,pool);
-	x = y;
+  if(self != NULL && self->pool == pool){
+    for(int i=0; i<n; i++){
+      if(!ws_deque_push(&self->deque, to_add[i])){
+	ws_inbox_push_many(self, &to_add[i], n-i);
+	break;
       }
-      ptrs[degree] = NULL;
-      degree++;
     }
-    ptrs[degree] = x;
-    x=x->pointer2;
+    return;
   }
 
-  //relink into doubly linked list
-  pool->head = fibonacci_relink(ptrs, length, pool);
-  
-  return;
-}
+  if(atomic_load(&pool->inbox_cursor) == NULL){
+    for(int i=0; i<n; i++){
+      ws_push_task(to_add[i], pool);
+    }
+    return;
+  }
 
-//splices task 'b' and siblings into root list with 'a'
-void fibonacci_splice(struct task* a, struct task* b){
+  int threads = (pool->number_threads > 0) ? pool->number_threads : 1;
+  int run = (n + threads - 1)/threads;
+  struct thread_info* target;
 
-  struct task* left_end = b;
-  struct task* right_end = left_end->pointer1;
+  for(int i=0; i<n; i+=run){
 
-  //insert into root list
-  struct task* right_neighbor = a->pointer2;
-  a->pointer2 = left_end;
-  left_end->pointer1 =a;
-  right_neighbor->pointer1 = right_end;
-  right_end->pointer2 = right_neighbor;
+    target = atomic_load(&pool->inbox_cursor);
+    atomic_store_explicit(&pool->inbox_cursor, ws_next_inbox(pool, target), memory_order_relaxed);
 
+    ws_inbox_push_many(target, &to_add[i], (n-i < run) ? n-i : run);
+  }
   return;
 }
-  
+
 /*
-  Sets the parent pointer of 'a' and all of the siblings of 'a' to
-  NULL
+  Looks in the calling thread's deque, then its inbox, and finally 
+  steals from the other threads. Tasks on the caller's own deque are
+  returned oldest first.
 */
-void fibonacci_set_parent_null(struct task* a){
+struct task* ws_FIFO_pull_task(struct thread_pool* pool){
+
+  struct thread_info* self = current_worker;
+  struct task* to_return;
+  int result;
 
-  struct task* left_end = a;
-  struct task* stop = left_end;
   do{
-    left_end->parent = NULL;
-    left_end = left_end->pointer2;
-  }while(left_end != stop);
+    do{
+      result = ws_deque_steal(&self->deque, &to_return);
+    }while(result == -1);
 
-  return;
+    if(result == 1){
+      return to_return;
+    }
+  }while(ws_inbox_drain(self) > 0);
+
+  return ws_steal_task(pool, self);
 }
 
-//unsplice 'a' from root list
-void fibonacci_unsplice(struct task* a){
+/*
+  Same as ws_FIFO_pull_task except the tasks on the caller's own deque
+  are returned newest first.
+*/
+struct task* ws_LIFO_pull_task(struct thread_pool* pool){
 
-  struct task* right_neighbor = a->pointer2;
-  struct task* left_neighbor = a->pointer1;
-  right_neighbor->pointer1 = left_neighbor;
-  left_neighbor->pointer2 = right_neighbor;
-  return;
+  struct thread_info* self = current_worker;
+  struct task* to_return;
+
+  do{
+    to_return = ws_deque_take(&self->deque);
+    if(to_return != NULL){
+      return to_return;
+    }
+  }while(ws_inbox_drain(self) > 0);
+
+  return ws_steal_task(pool, self);
 }
 
+//====================Ring Buffer Functions========================
+
 /*
-  Adds a task to the fibonacci heap. Simply splices the task into the
-  root list. Updates pool->head if the task just added is the highest
-  priority task.
+  A fixed capacity ring of slots. Each slot carries a sequence number.
+  A producer may fill the slot at position 'pos' when its sequence is
+  'pos'; it then sets the sequence to 'pos'+1 which lets a consumer 
+  empty it. The consumer sets the sequence to 'pos'+capacity, which
+  hands the slot to the producer one lap later. Producers and consumers
+  claim positions by compare and swap on enqueue_pos and dequeue_pos.
 */
-void fibonacci_push_task(struct task* to_add, struct thread_pool* pool){
 
-  to_add->pointer1 = to_add;
-  to_add->pointer2 = to_add;
-  to_add->parent = NULL;
+#ifndef RING_BUFFER_CAPACITY
+#define RING_BUFFER_CAPACITY 65536
+#endif
 
-  if(pool->head == NULL){
+//capacity is rounded up to a power of two
+struct ring_buffer* ring_create(size_t capacity){
 
-    pool->head = to_add;
+  size_t size = 2;
+  while(size < capacity){
+    size = size*2;
   }
-  else{
-    
-    fibonacci_splice(pool->head, to_add);
 
-    if(pool->comp_function(to_add->arg, pool->head->arg) > 0){
-      pool->head = to_add;
-    }
+  struct ring_buffer* r = aligned_alloc(64, sizeof(struct ring_buffer));
+  if(r == NULL){
+    printf("ERROR: Could not allocate ring buffer\n");
+    return NULL;
   }
 
-  return;
+  r->slots = malloc(size*sizeof(struct ring_slot));
+  if(r->slots == NULL){
+    printf("ERROR: Could not allocate ring buffer\n");
+    free(r);
+    return NULL;
+  }
+
+  r->mask = size-1;
+  for(size_t i=0; i<size; i++){
+    atomic_init(&r->slots[i].sequence, i);
+    r->slots[i].task = NULL;
+  }
+  atomic_init(&r->enqueue_pos, 0);
+  atomic_init(&r->dequeue_pos, 0);
+
+  return r;
 }
 
-struct task* fibonacci_pull_task(struct thread_pool* pool){
+void ring_free(struct ring_buffer* r){
 
-  if(pool->head == NULL){
-    return NULL;
+  if(r != NULL){
+    free(r->slots);
+    free(r);
   }
-  
-  struct task* to_return = pool->head;
+  return;
+}
 
-  //if they exist promote the children of node to be
-  //removed to the root list
-  if(to_return->child != NULL){
+/*
+  Claims the next free slot and stores 'to_add' in it. If the ring is
+  full a thread of the pool runs the oldest task itself to make room,
+  and so does any thread when the pool has no threads to empty it. 
+  Otherwise the thread wakes the sleeping threads, since a batch only 
+  wakes them once it is fully pushed, and yields until they have made
+  room.
+*/
+void ring_push_task(struct task* to_add, struct thread_pool* pool){
 
-    fibonacci_set_parent_null(to_return->child);
-    fibonacci_splice(to_return, to_return->child);
-  }
+  struct ring_buffer* r = pool->ring;
+  struct ring_slot* slot;
+  size_t pos = atomic_load_explicit(&r->enqueue_pos, memory_order_relaxed);
 
-  if(to_return->pointer2 == to_return){
-    pool->head = NULL;
+  while(1){
+
+    slot = &r->slots[pos&r->mask];
+    size_t seq = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+    if(diff == 0){
+      if(atomic_compare_exchange_weak_explicit(&r->enqueue_pos, &pos, pos+1, memory_order_relaxed, memory_order_relaxed)){
+	break;
+      }
+    }
+    else if(diff < 0){
+
+      //full
+      struct task* oldest = NULL;
+      if((current_worker != NULL && current_worker->pool == pool) || atomic_load(&pool->number_threads) == 0){
+	oldest = ring_pull_task(pool);
+      }
+
+      if(oldest != NULL){
+	run_task(oldest, pool);
+      }
+      else{
+	if(atomic_load(&pool->num_idle_threads) > 0){
+	  pthread_mutex_lock(&pool->modify_pool);
+	  wake_threads(pool, pool->number_threads);
+	  pthread_mutex_unlock(&pool->modify_pool);
+	}
+	sched_yield();
+      }
+      pos = atomic_load_explicit(&r->enqueue_pos, memory_order_relaxed);
+    }
+    else{
+      //another producer claimed this position first
+      pos = atomic_load_explicit(&r->enqueue_pos, memory_order_relaxed);
+    }
   }
-  else{
 
-    //update head
-    pool->head = to_return->pointer1;
-    
-    //remove to_return
-    fibonacci_unsplice(to_return);
+  slot->task = to_add;
+  atomic_store_explicit(&slot->sequence, pos+1, memory_order_release);
+  return;
+}
 
-    fibonacci_consolidate(pool);
+//Returns the oldest task in the ring or NULL if the ring is empty
+struct task* ring_pull_task(struct thread_pool* pool){
+
+  struct ring_buffer* r = pool->ring;
+  struct ring_slot* slot;
+  size_t pos = atomic_load_explicit(&r->dequeue_pos, memory_order_relaxed);
+
+  while(1){
+
+    slot = &r->slots[pos&r->mask];
+    size_t seq = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)(pos+1);
+
+    if(diff == 0){
+      if(atomic_compare_exchange_weak_explicit(&r->dequeue_pos, &pos, pos+1, memory_order_relaxed, memory_order_relaxed)){
+	break;
+      }
+    }
+    else if(diff < 0){
+      //empty
+      return NULL;
+    }
+    else{
+      pos = atomic_load_explicit(&r->dequeue_pos, memory_order_relaxed);
+    }
   }
-  return to_return;
 
+  struct task* to_return = slot->task;
+  atomic_store_explicit(&slot->sequence, pos+r->mask+1, memory_order_release);
+  return to_return;
 }
 
-//====================FIFO Functions===============================
 
+
+//==================Bucket Queue Functions=========================
 /*
-  For First In First Out functions 'pointer1' refers to the task's 
-  newer sibling and 'pointer2' refers older sibling.
+  Tasks are placed in the level given by their priority, clamped to 
+  0 through BUCKET_QUEUE_LEVELS-1, and the highest level is pulled 
+  first. Within a level tasks run in the order they were added.
+  'pointer1' refers to the next task in the level and 'pointer2' to 
+  the one before it.
 */
 
-void FIFO_push_task(struct task* to_add, struct thread_pool* pool){
+struct bucket_queue* bucket_create(void){
 
-  if(pool->head == NULL){
-    pool->head = to_add;
-    to_add->pointer1 = NULL;
-    pool->tail = to_add;
+  struct bucket_queue* b = calloc(1, sizeof(struct bucket_queue));
+  if(b == NULL){
+    printf("ERROR: Could not allocate bucket queue\n");
+  }
+  return b;
+}
+
+//Returns the level of tasks with 'priority'
+int bucket_level(int64_t priority){
+
+  if(priority < 0){
+    return 0;
+  }
+  else if(priority >= BUCKET_QUEUE_LEVELS){
+    return BUCKET_QUEUE_LEVELS-1;
+  }
+  return (int)priority;
+}
+
+void bucket_push_task(struct task* to_add, struct thread_pool* pool){
+
+  struct bucket_queue* b = pool->buckets;
+  int level = bucket_level(to_add->priority);
+
+  to_add->pointer1 = NULL;
+  to_add->pointer2 = b->tail[level];
+  if(b->head[level] == NULL){
+    b->head[level] = to_add;
     to_add->pointer2 = NULL;
+    b->nonempty[level/64] |= (uint64_t)1<<(level%64);
   }
   else{
-    to_add->pointer2 = pool->tail;
-    to_add->pointer1 = NULL;
-    pool->tail->pointer1 = to_add;
-    pool->tail = to_add;
+    b->tail[level]->pointer1 = to_add;
   }
+  b->tail[level] = to_add;
   return;
-  
 }
 
-struct task* FIFO_pull_task(struct thread_pool* pool){
-  
-  struct task* to_return = pool->head;
+//Returns the oldest task of the highest non-empty level
+struct task* bucket_pull_task(struct thread_pool* pool){
 
-  pool->head = pool->head->pointer1;
+  struct bucket_queue* b = pool->buckets;
+  int word = BUCKET_QUEUE_LEVELS/64-1;
 
-  //Just dequeued the only element in linked list
-  if(pool->head == NULL){
-    pool->tail = NULL;
+  while(b->nonempty[word] == 0){
+    word--;
+  }
+
+  int level = word*64 + 63 - __builtin_clzll(b->nonempty[word]);
+  struct task* to_return = b->head[level];
+
+  b->head[level] = to_return->pointer1;
+  if(b->head[level] == NULL){
+    b->nonempty[word] &= ~((uint64_t)1<<(level%64));
   }
   else{
-    pool->head->pointer2 = NULL;
+    b->head[level]->pointer2 = NULL;
   }
-
   return to_return;
 }
 
-//====================LIFO Functions===============================
-
-/*
-  For Last In First Out functions 'pointer1' refers to the next 
-  task in line for execution. 
+/*Gives a task a new priority. If that changes its level it is taken
+out of the old level and added to the back of the new one. Otherwise 
+it keeps its place.
 */
+void bucket_update_task(struct task* to_update, int64_t priority, struct thread_pool* pool){
 
+  if(bucket_level(priority) == bucket_level(to_update->priority)){
+    to_update->priority = priority;
+    return;
+  }
 
-void LIFO_push_task(struct task* to_add, struct thread_pool* pool){
-
-  struct task* temp = pool->head;
-  pool->head = to_add;
-  to_add->pointer1 = temp;
+  bucket_remove_task(to_update, pool);
+  to_update->priority = priority;
+  bucket_push_task(to_update, pool);
   return;
 }
 
-struct task* LIFO_pull_task(struct thread_pool* pool){
+//Unlinks 'to_remove' from its level
+void bucket_remove_task(struct task* to_remove, struct thread_pool* pool){
 
-  if(pool->head == NULL){
-    printf("ERROR: Attempted to remove task when no task is in queue.");
-    return NULL;
+  struct bucket_queue* b = pool->buckets;
+  int level = bucket_level(to_remove->priority);
+
+  if(to_remove->pointer2 == NULL){
+    b->head[level] = to_remove->pointer1;
+  }
+  else{
+    to_remove->pointer2->pointer1 = to_remove->pointer1;
   }
 
-  struct task* to_return = pool->head;
-  pool->head = to_return->pointer1;
+  if(to_remove->pointer1 == NULL){
+    b->tail[level] = to_remove->pointer2;
+  }
+  else{
+    to_remove->pointer1->pointer2 = to_remove->pointer2;
+  }
 
-  return to_return;
+  if(b->head[level] == NULL){
+    b->nonempty[level/64] &= ~((uint64_t)1<<(level%64));
+  }
+  return;
 }
 
 #endif /*QUEUE_FUNCTIONS*/
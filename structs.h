@@ -1,12 +1,124 @@
 #ifndef STRUCTS
 #define STRUCTS
 
+#include <stdatomic.h>
+#include <stdint.h>
+
+/* Circular buffer behind a work stealing deque. When it fills up it is
+   replaced by a buffer twice the size. Thieves may still be reading the
+   old buffer so it is kept on 'prev' until the deque is freed.
+*/
+struct ws_array{
+
+  long size;
+  struct ws_array* prev;
+  _Atomic(struct task*) buffer[];
+};
+
+/* Chase-Lev deque. The owning thread pushes and pops at 'bottom', other
+   threads steal from 'top'.
+*/
+struct ws_deque{
+
+  atomic_long top;
+  atomic_long bottom;
+  _Atomic(struct ws_array*) array;
+};
+
+/* An element of the array backed binary heap. The argument and the
+   priority are copied next to the task so comparisons never have to
+   dereference the task.
+*/
+struct heap_entry{
+
+  void* arg;
+  int64_t priority;
+  struct task* task;
+};
+
+/* One slot of the lock-free ring buffer. 'sequence' tells producers and
+   consumers whose turn it is to use the slot.
+*/
+struct ring_slot{
+
+  atomic_size_t sequence;
+  struct task* task;
+};
+
+/* Bounded multi-producer/multi-consumer queue. The positions are kept
+   on separate cache lines so producers and consumers do not contend.
+*/
+struct ring_buffer{
+
+  size_t mask;
+  struct ring_slot* slots;
+  _Alignas(64) atomic_size_t enqueue_pos;
+  _Alignas(64) atomic_size_t dequeue_pos;
+};
+
+/* Bucket queue of BUCKET_QUEUE_LEVELS priority levels. Each level is a
+   First In First Out list and bit 'level' of 'nonempty' is set while
+   that list has tasks, so the highest waiting level is found with a
+   count of leading zeros.
+*/
+#define BUCKET_QUEUE_LEVELS 256
+
+struct bucket_queue{
+
+  uint64_t nonempty[BUCKET_QUEUE_LEVELS/64];
+  struct task* head[BUCKET_QUEUE_LEVELS];
+  struct task* tail[BUCKET_QUEUE_LEVELS];
+};
+
+/* For work stealing modes each thread owns 'deque'. Tasks added from
+   outside the pool are placed on a thread's 'inbox' which is protected
+   by 'inbox_lock'. 'seed' drives the choice of victim when stealing.
+
+   An idle thread sleeps on its own 'wake' condition variable while it
+   is on the pool's idle stack, linked through 'next_idle'. 'woken' is
+   set by the thread that pops it off. 'spin_budget' is how many times
+   the thread checks for work before it gives up and parks.
+
+   A thread removed from the pool stays on 'thread_list', since other
+   threads may still be stealing from its deque, with 'state' set to 
+   THREAD_RETIRED. Its last access to the pool sets THREAD_EXITED, 
+   after which add_threads may reuse the thread_info for a new thread.
+   'cache' is the thread's task_cache, which also holds its counters,
+   and 'last_run' the time its last task finished.
+*/
+#define THREAD_RUNNING 0
+#define THREAD_RETIRED 1
+#define THREAD_EXITED 2
 
 struct thread_info{
 
   struct thread_pool* pool;
   pthread_t thread;
   struct thread_info* next;
+  struct ws_deque deque;
+  pthread_mutex_t inbox_lock;
+  _Atomic(struct task*) inbox_head;
+  struct task* inbox_tail;
+  unsigned int seed;
+  pthread_cond_t wake;
+  int woken;
+  struct thread_info* next_idle;
+  int spin_budget;
+  atomic_int state;
+  _Atomic(struct task_cache*) cache;
+  unsigned long last_run;
+};
+
+/* 'pending' counts the tasks of a group that have been added but have
+   not finished running. Threads waiting for it to reach 0 set the
+   GROUP_WAITERS bit in it and sleep on it.
+*/
+#define GROUP_WAITERS (1<<30)
+
+struct task_group{
+
+  struct thread_pool* pool;
+  atomic_int pending;
 };
 
 /* For binary heap:
@@ -19,38 +131,308 @@ struct thread_info{
    For fibonacci heap:
    pointer1 refers to a task's left sibling
    pointer2 refers to a task's right sibling
+   'marked' is set when a task that is a child loses a child of its
+   own, and it is cut from its parent if it loses another
+
+   For the array binary heap and the 8-ary heap:
+   'heap_index' is the index of the task's entry in the array
 
    For FIFO list:
-   'pointer1' refers to 
+   'pointer1' refers to a task's newer sibling
+   'pointer2' refers to a task's older sibling
+
+   For a work stealing inbox:
+   'pointer1' refers to the next task in the inbox
+
+   While a task is free in a task_cache:
+   'pointer1' refers to the next free task
+
+   'cache' is the task_cache the task was allocated from
+
+   'priority' is the key given to add_task_with_priority or 
+   add_task_with_handle. It is 0 for tasks added any other way.
+
+   For tasks added with add_task_future 'future_function' is run in
+   place of 'function' and its return value is kept in 'result'. 'state'
+   holds the FUTURE_* bits and is the word waiting threads sleep on.
+   'references' counts the handle and the pending run, and the task is
+   only freed once both are released. 'then_function' is called with
+   'result' and 'then_arg' once the task completes. 'future_function' is
+   NULL for every other task. Tasks added with add_task_with_handle run
+   'function' but are otherwise handles like these. 'references' is 0 
+   for tasks nobody holds a handle to.
+
+   'group' is the task_group the task was added to, if any.
+
+   'node' is the node of a task graph the task runs, if any.
+
+   'children' counts the tasks added with pool_spawn while this task
+   ran that have not finished.
+
+   'internal' is set for tasks the pool adds itself, such as the helpers
+   of pool_parallel_for. Their argument is not the user's, so they are
+   never passed to the comparison function. They have the highest
+   priority, since a caller is always blocked waiting on them.
 
+   'enqueued' is the time the task was added, kept while the pool 
+   records latency histograms.
+
+   'queued' is set while the task waits in the queue of one of the 
+   locked modes. It is only read or written under modify_pool.
 */
 struct task{
 
   void (*function)(void* arg);
   void* arg;
+  int64_t priority;
   int order;
   int degree;
+  int marked;
+  unsigned int heap_index;
   struct task* parent;
   struct task* child;
   struct task* pointer1;
   struct task* pointer2;
   struct task* sibling;
+  struct task_cache* cache;
+  void* (*future_function)(void* arg);
+  void* result;
+  atomic_int state;
+  atomic_int references;
+  void (*then_function)(void* result, void* arg);
+  void* then_arg;
+  struct task_group* group;
+  struct graph_node* node;
+  int internal;
+  struct task_group children;
+  unsigned long enqueued;
+  int queued;
+};
+
+/* A block of tasks allocated at once by a task_cache.
+*/
+struct task_slab{
+
+  struct task_slab* next;
+  int size;
+  struct task tasks[];
+};
+
+/* Counters of one thread for one pool, read by pool_get_stats. Only
+   that thread writes them, with a relaxed load and store rather than
+   an atomic add, so keeping them costs no more than plain variables.
+   Times are in nanoseconds.
+*/
+struct thread_stats{
+
+  atomic_ulong tasks_added;
+  atomic_ulong tasks_run;
+  atomic_ulong busy_ns;
+  atomic_ulong idle_ns;
+  atomic_ulong lock_waits;
+  atomic_ulong lock_wait_ns;
+  atomic_ulong lock_hold_ns;
+  atomic_ulong max_queue_depth;
+};
+
+/* Histograms of how long tasks waited in the queue and how long they
+   ran, one of each for every priority class. They are log-linear: 
+   times under 8 ns have a bucket each, and above that every power of
+   two is split into 8 buckets, so a time is known to within 12.5%. The
+   last bucket holds everything from about 2^42 ns up.
+*/
+#define LATENCY_CLASSES 8
+#define LATENCY_SUB_BUCKETS 8
+#define LATENCY_BUCKETS 320
+
+struct latency_histograms{
+
+  atomic_ulong wait[LATENCY_CLASSES][LATENCY_BUCKETS];
+  atomic_ulong run[LATENCY_CLASSES][LATENCY_BUCKETS];
+};
+
+/* Free tasks belonging to one thread of one pool. Only the owning
+   thread uses 'local_free'. Tasks freed by any other thread are pushed
+   onto 'remote_free' and taken back by the owner in one exchange when
+   'local_free' runs out. 'pool' is the pool the cache belongs to. 
+   'slabs' lists every block this cache has allocated so the pool can
+   free them when destroyed. When a thread leaves the pool or exits 
+   its cache is 'orphaned' and handed to the next thread that needs
+   one. 'stats' are the thread's counters, on a cache line of their 
+   own, 'latency' its histograms once the pool records them and 
+   'locked_at' the time it last took the pool's lock, unless 
+   THREAD_POOL_NO_STATS is defined.
+
+   'tasks_submitted' and 'tasks_finished' count the tasks the thread
+   has added to the pool and has finished running. pool_pending adds
+   them up over every cache.
+*/
+struct task_cache{
+
+  struct task* local_free;
+  struct task_slab* slabs;
+  int next_slab_size;
+  pthread_t owner;
+  int orphaned;
+  struct thread_pool* pool;
+  struct task_cache* next;
+  atomic_ulong tasks_submitted;
+  atomic_ulong tasks_finished;
+  _Alignas(64) _Atomic(struct task*) remote_free;
+#ifndef THREAD_POOL_NO_STATS
+  _Alignas(64) struct thread_stats stats;
+  _Atomic(struct latency_histograms*) latency;
+  unsigned long locked_at;
+#endif
+};
+
+/* Shared by the threads running one parallel loop. Each thread claims
+   the next 'grain' iterations from 'next' until it passes 'end'.
+   'remaining' counts iterations that have not finished and the thread
+   that brings it to 0 sets FUTURE_DONE in 'state', which the caller
+   waits on. 'references' counts the caller and the helper tasks, and 
+   the last one to finish frees the job. The counters every thread 
+   writes are kept on their own cache lines.
+
+   A loop that reduces has a 'reduce_body' instead of a 'body'. Each
+   thread taking part claims one of the 'slots' through 'next_slot' and
+   adds its iterations into it. Slots are 'size' bytes, 'stride' apart,
+   a multiple of the cache line so no two threads share one.
+*/
+struct parallel_job{
+
+  void (*body)(long begin, long end, void* ctx);
+  void (*reduce_body)(long begin, long end, void* partial, void* ctx);
+  void (*combine)(void* into, const void* from, void* ctx);
+  void* ctx;
+  size_t size;
+  size_t stride;
+  char* slots;
+  long end;
+  long grain;
+  atomic_int references;
+  atomic_int state;
+  atomic_int next_slot;
+  _Alignas(64) atomic_long next;
+  _Alignas(64) atomic_long remaining;
+};
+
+/* Wraps the functions given to pool_map_reduce so they can be run as
+   the body of pool_parallel_reduce.
+*/
+struct map_reduce_info{
+
+  void (*map)(long i, void* value, void* ctx);
+  void (*combine)(void* into, const void* from, void* ctx);
+  void* ctx;
+  size_t size;
+};
+
+/* A node of a task graph. 'successors' holds the ids of the nodes
+   that wait for this one and 'in_degree' the number of nodes it waits
+   for. While the graph runs 'pending' counts the nodes it still waits
+   for, and it is ready once that reaches 0.
+*/
+struct graph_node{
+
+  struct task_graph* graph;
+  void (*function)(void* arg);
+  void* arg;
+  int* successors;
+  int num_successors;
+  int successor_capacity;
+  int in_degree;
+  atomic_int pending;
 };
 
+/* The nodes of a task graph. 'group' counts the nodes of the current
+   run that have not finished. 'verified' is set once the graph has 
+   been checked for cycles and cleared whenever it changes.
+*/
+struct task_graph{
+
+  struct thread_pool* pool;
+  struct graph_node* nodes;
+  int num_nodes;
+  int node_capacity;
+  int verified;
+  struct task_group group;
+};
+
+/* 'degree_table' is where the Fibonacci Heap and the Lazy Binomial 
+   Heap pair up trees of equal degree. A degree is at most about 1.44
+   times the base two logarithm of the number of tasks, so this many 
+   degrees cover any queue that fits in memory. 'lazy_max' is the 
+   highest priority root of the Lazy Binomial Heap.
+*/
+#define DEGREE_TABLE_SIZE 64
+
 struct thread_pool{
 
   pthread_mutex_t modify_pool;
-  pthread_cond_t signal_change;
-  int number_threads;
+  atomic_int number_threads;
   struct task* head;
   struct task* tail;
-  unsigned int num_tasks_in_queue;
+  atomic_uint num_tasks_in_queue;
   struct task* (*pull)(struct thread_pool* pool);
   void (*push)(struct task* to_add, struct thread_pool* pool);
+  void (*push_batch)(struct task* to_add[], int n, struct thread_pool* pool);
+  void (*update)(struct task* to_update, int64_t priority, struct thread_pool* pool);
+  void (*remove)(struct task* to_remove, struct thread_pool* pool);
   int (*comp_function)(const void* p1, const void* p2);  
-  int kill_immediately;
-  int kill_when_idle;
-  struct thread_info* thread_list;
+  int lock_free;
+  struct ring_buffer* ring;
+  struct bucket_queue* buckets;
+  struct heap_entry* heap_array;
+  unsigned int heap_capacity;
+  int64_t* dary_keys;
+  struct task** dary_tasks;
+  unsigned int dary_capacity;
+  struct task* degree_table[DEGREE_TABLE_SIZE];
+  struct task* lazy_max;
+  atomic_int num_idle_threads;
+  struct thread_info* idle_stack;
+  atomic_int idle_policy;
+  atomic_int num_spinning;
+  atomic_ulong spin_hits;
+  atomic_ulong spin_misses;
+  _Atomic(struct thread_info*) inbox_cursor;
+  atomic_int kill_immediately;
+  atomic_int kill_when_idle;
+  _Atomic(struct thread_info*) thread_list;
+  unsigned long pool_id;
+  pthread_mutex_t modify_caches;
+  pthread_key_t cache_key;
+  struct task_cache* caches;
+  atomic_ulong slabs_allocated;
+  atomic_ulong tasks_allocated;
+  atomic_int idle_waiting;
+  int* cpus;
+  int num_cpus;
+  int pin_each;
+  int next_cpu;
+  struct numa_pool* numa;
+  int node;
+  struct thread_pool** neighbours;
+  int num_neighbours;
+  atomic_int threads_to_remove;
+  atomic_int min_threads;
+  atomic_int max_threads;
+  atomic_long keep_alive_ms;
+  atomic_long next_scale;
+  atomic_int latency_classes;
+  int64_t latency_bounds[LATENCY_CLASSES-1];
+};
+
+/* A pool of pools, one for each NUMA node, whose threads only run on
+   the CPUs of that node. Tasks added from outside without a node go 
+   to the pools in turn starting from 'next_node'.
+*/
+struct numa_pool{
+
+  struct thread_pool** nodes;
+  int num_nodes;
+  atomic_uint next_node;
 };
 
 #endif /*STRUCTS*/
@@ -6,47 +6,316 @@ the functions.
 */
 
 
+//for CPU affinity
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include <pthread.h>
 #include <errno.h>
 #include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
 #include "thread_pool.h"
 #include "structs.h"
 #include "queues.h"
 
 
+/*Every pool gets a distinct id so a thread's cached pointer to its 
+task_cache can never be mistaken for one belonging to a newer pool
+allocated at the same address.
+*/
+static atomic_ulong next_pool_id = 1;
+
+#define TASK_CACHE_SLOTS 4
+#define TASK_SLAB_MIN 64
+#define TASK_SLAB_MAX 4096
+
+static _Thread_local struct task_cache* local_caches[TASK_CACHE_SLOTS];
+static _Thread_local unsigned long local_cache_ids[TASK_CACHE_SLOTS];
+static _Thread_local int local_cache_victim = 0;
+
+/*pool_parallel_for with no grain times the loop body on a few 
+iterations, doubling their number until PARALLEL_PROBE_NS have passed,
+and then picks a grain that makes each chunk take about 
+PARALLEL_CHUNK_NS. The grain is capped so every thread gets at least
+PARALLEL_CHUNKS_PER_THREAD chunks to balance the load.
+*/
+#define PARALLEL_PROBE_NS 20000
+#define PARALLEL_CHUNK_NS 50000
+#define PARALLEL_CHUNKS_PER_THREAD 8
+
+//ready nodes of a task graph are added in batches of at most this many
+#define GRAPH_BATCH 32
+
+/*With idle policy 2 a thread out of work checks the queue up to 
+'spin_budget' times, pausing between checks, and then yields 
+IDLE_YIELDS times before it parks. The budget doubles each time 
+spinning finds a task and halves each time it does not, staying 
+between SPIN_MIN and SPIN_MAX.
+*/
+#define SPIN_MIN 32
+#define SPIN_MAX 16384
+#define SPIN_INITIAL 1024
+#define IDLE_YIELDS 4
+
+/*create_numa_pool finds the CPUs of each node 0 to NUMA_MAX_NODES-1 
+in NUMA_SYSFS. CPUs numbered NUMA_MAX_CPUS or more are ignored.
+*/
+#ifndef NUMA_SYSFS
+#define NUMA_SYSFS "/sys/devices/system/node"
+#endif
+#define NUMA_MAX_NODES 64
+#define NUMA_MAX_CPUS 1024
+
+/*With pool_set_autoscale a thread is added when no thread is idle and
+more than AUTOSCALE_BACKLOG tasks per thread are waiting or running, 
+at most once every AUTOSCALE_INTERVAL_NS so that a burst does not 
+start more threads than it needs.
+*/
+#define AUTOSCALE_BACKLOG 2
+#define AUTOSCALE_INTERVAL_NS 1000000
+
+/*Each thread counts into the stats of its own task_cache, see 
+structs.h. Defining THREAD_POOL_NO_STATS removes the counters and 
+every update of them. STAT_LOCKED and STAT_UNLOCKED bracket the time
+a thread holds modify_pool.
+*/
+#ifndef THREAD_POOL_NO_STATS
+#define STAT_ADD(stats, field, value) atomic_store_explicit(&(stats)->field, atomic_load_explicit(&(stats)->field, memory_order_relaxed)+(value), memory_order_relaxed)
+#define STAT_MAX(stats, field, value) do{ if((unsigned long)(value) > atomic_load_explicit(&(stats)->field, memory_order_relaxed)) atomic_store_explicit(&(stats)->field, (value), memory_order_relaxed); }while(0)
+#define STAT_LOCKED(cache) ((cache)->locked_at = stat_clock())
+#define STAT_UNLOCKED(cache) STAT_ADD(&(cache)->stats, lock_hold_ns, stat_clock() - (cache)->locked_at)
+#else
+#define STAT_ADD(stats, field, value) ((void)0)
+#define STAT_MAX(stats, field, value) ((void)(value))
+#define STAT_LOCKED(cache) ((void)(cache))
+#define STAT_UNLOCKED(cache) ((void)(cache))
+#endif
+
+/*The task the calling thread is running, whose children pool_spawn 
+adds to. Children spawned outside of any task go to 'root_children'.
+*/
+static _Thread_local struct task* current_task = NULL;
+static _Thread_local struct task_group root_children;
+
+//bits of a future task's 'state'
+#define FUTURE_DONE 1
+#define FUTURE_THEN 2
+#define FUTURE_WAITERS 4
+#define FUTURE_THEN_CLAIMED 8
+#define FUTURE_STARTED 16
+#define FUTURE_CANCELLED 32
+
+
 //Function Declarations-------------------------------------
 
 
 struct thread_pool* create_pool(int number_threads, int mode, int (*function)(const void* p1, const void* p2));
 void set_queue_mode(struct thread_pool* pool, int mode);
 void add_threads(int number_to_add, struct thread_pool* pool);
+void remove_threads(int number_to_remove, struct thread_pool* pool);
+void pool_set_autoscale(struct thread_pool* pool, int min_threads, int max_threads, long keep_alive_ms);
+static void autoscale(struct thread_pool* pool);
+static int retire_thread(struct thread_info* self);
+static void leave_pool(struct thread_info* self);
 void add_task(struct thread_pool* pool, void (*function)(void* arg), void* arg);
+void add_task_with_priority(struct thread_pool* pool, void (*function)(void* arg), void* arg, int64_t priority);
+void submit_task(struct thread_pool* pool, struct task* new_task);
+void add_tasks(struct thread_pool* pool, void (*functions[])(void* arg), void* args[], int n);
+void add_tasks_one_function(struct thread_pool* pool, void (*function)(void* arg), void* args[], int n);
+void submit_tasks(struct thread_pool* pool, struct task* tasks[], int n);
+void wake_threads(struct thread_pool* pool, int n);
 struct task* pull_task(struct thread_pool* pool);
+struct task* lock_free_get_task(struct thread_info* self, struct thread_pool** owner);
+static struct task* spin_for_task(struct thread_info* self);
+static void cpu_relax(void);
+void pool_set_idle_policy(struct thread_pool* pool, int policy);
+void pool_idle_stats(struct thread_pool* pool, unsigned long* hits, unsigned long* misses);
+int park_thread(struct thread_info* self);
+void run_task(struct task* to_do, struct thread_pool* pool);
+static void worker_run(struct thread_info* self, struct task* to_do, struct thread_pool* owner);
+static void lock_pool(struct thread_pool* pool, struct task_cache* cache);
+static void unlock_pool(struct thread_pool* pool, struct task_cache* cache);
+static unsigned long stat_clock(void);
+void pool_get_stats(struct thread_pool* pool, struct pool_stats* snapshot);
+int pool_get_worker_stats(struct thread_pool* pool, struct pool_stats* workers, int max);
+static void add_thread_stats(struct pool_stats* snapshot, struct task_cache* cache);
+static unsigned long lock_free_depth(struct thread_pool* pool);
 void* do_work(void* parameter);
 void close_immediately(struct thread_pool* pool);
 void close_when_idle(struct thread_pool* pool);
 void destroy_pool_immediately(struct thread_pool* pool);
 void destroy_pool_when_idle(struct thread_pool* pool);
+static void join_threads(struct thread_pool* pool);
+static void free_pool(struct thread_pool* pool);
+
+//Future Functions-------------------------------------------
+struct task* add_task_future(struct thread_pool* pool, void* (*function)(void* arg), void* arg);
+void complete_future(struct task* handle);
+void future_sleep(atomic_int* state, int expected, const struct timespec* timeout);
+void future_wake(atomic_int* state);
+void future_wait(atomic_int* state);
+void* task_wait(struct task* handle);
+int task_try_wait(struct task* handle);
+int task_wait_timeout(struct task* handle, long milliseconds);
+void* task_result(struct task* handle);
+void task_then(struct task* handle, void (*function)(void* result, void* arg), void* arg);
+void task_release(struct task* handle);
+
+//Task Handle Functions--------------------------------------
+struct task* add_task_with_handle(struct thread_pool* pool, void (*function)(void* arg), void* arg, int64_t priority);
+int pool_update_priority(struct thread_pool* pool, struct task* handle, int64_t priority);
+int pool_cancel(struct thread_pool* pool, struct task* handle);
+int task_cancelled(struct task* handle);
+
+//Task Group Functions---------------------------------------
+struct task_group* create_task_group(struct thread_pool* pool);
+void add_task_to_group(struct task_group* group, void (*function)(void* arg), void* arg);
+void task_group_done(struct task_group* group);
+struct task* try_pull_task(struct thread_pool* pool);
+void task_group_wait(struct task_group* group);
+void destroy_task_group(struct task_group* group);
+void count_finished(struct thread_pool* pool, struct task_cache* fallback);
+long pool_pending(struct thread_pool* pool);
+void pool_wait_idle(struct thread_pool* pool);
+void pool_spawn(struct thread_pool* pool, void (*function)(void* arg), void* arg);
+void pool_sync(struct thread_pool* pool);
+
+//Task Graph Functions---------------------------------------
+struct task_graph* create_task_graph(struct thread_pool* pool);
+int task_graph_add_node(struct task_graph* graph, void (*function)(void* arg), void* arg);
+void task_graph_add_edge(struct task_graph* graph, int from, int to);
+static int task_graph_acyclic(struct task_graph* graph);
+void task_graph_submit(struct task_graph* graph);
+static void submit_graph_nodes(struct task_graph* graph, struct graph_node* nodes[], int n);
+static void graph_node_done(struct graph_node* node, int run_first);
+void task_graph_wait(struct task_graph* graph);
+void destroy_task_graph(struct task_graph* graph);
+
+//Parallel Loop Functions------------------------------------
+void pool_parallel_for(struct thread_pool* pool, long begin, long end, long grain, void (*body)(long begin, long end, void* ctx), void* ctx);
+void pool_parallel_reduce(struct thread_pool* pool, long begin, long end, long grain, void* result, size_t size, void (*body)(long begin, long end, void* partial, void* ctx), void (*combine)(void* into, const void* from, void* ctx), void* ctx);
+void pool_map_reduce(struct thread_pool* pool, long begin, long end, long grain, void* result, size_t size, void (*map)(long i, void* value, void* ctx), void (*combine)(void* into, const void* from, void* ctx), void* ctx);
+static void map_reduce_body(long begin, long end, void* partial, void* ctx);
+static void map_reduce_combine(void* into, const void* from, void* ctx);
+static void parallel_loop(struct thread_pool* pool, long begin, long end, long grain, struct parallel_job* setup, void* result);
+static void parallel_chunk(struct parallel_job* job, long begin, long end, void* partial);
+static long parallel_grain(struct thread_pool* pool, long* begin, long end, struct parallel_job* setup, void* result);
+static int parallel_helpers(struct thread_pool* pool, long chunks);
+static int submit_internal_tasks(struct thread_pool* pool, void (*function)(void* arg), void* arg, int n);
+static void parallel_run(struct parallel_job* job);
+static void parallel_helper(void* arg);
+static void parallel_job_release(struct parallel_job* job);
+
+//NUMA Functions---------------------------------------------
+void pool_set_affinity(struct thread_pool* pool, const int* cpus, int n);
+static void pin_thread(struct thread_pool* pool, pthread_t thread, int slot);
+struct numa_pool* create_numa_pool(int threads_per_node, int mode, int (*function)(const void* p1, const void* p2));
+static int read_cpu_list(const char* path, int* cpus, int max);
+static int read_node_distances(int node, int* distances, int max);
+static void link_numa_nodes(struct numa_pool* numa, int* node_ids, int* ranks);
+int numa_pool_nodes(struct numa_pool* numa);
+struct thread_pool* numa_pool_node(struct numa_pool* numa, int node);
+void add_task_on_node(struct numa_pool* numa, int node, void (*function)(void* arg), void* arg);
+static struct task* steal_remote_task(struct thread_info* self, struct thread_pool** owner);
+static void wake_neighbour(struct thread_pool* pool);
+void destroy_numa_pool_when_idle(struct numa_pool* numa);
+void destroy_numa_pool_immediately(struct numa_pool* numa);
+
+//Latency Functions------------------------------------------
+void pool_set_latency_classes(struct thread_pool* pool, const int64_t* bounds, int n);
+static void latency_stamp(struct thread_pool* pool, struct task* tasks[], int n);
+static void record_latency(struct thread_pool* pool, struct task* to_do, unsigned long start, unsigned long end);
+#ifndef THREAD_POOL_NO_STATS
+static int latency_bucket(unsigned long ns);
+static unsigned long latency_value(int bucket);
+#endif
+void pool_get_latency(struct thread_pool* pool, int interval, int priority_class, struct pool_latency* result);
+
+//Task Allocator Functions-----------------------------------
+struct task_cache* get_task_cache(struct thread_pool* pool);
+struct task* alloc_task(struct thread_pool* pool);
+void free_task(struct task* to_free, struct thread_pool* pool);
+void free_task_caches(struct thread_pool* pool);
+static void release_task_cache(struct thread_pool* pool);
+void orphan_task_cache(void* cache);
+void pool_allocator_stats(struct thread_pool* pool, unsigned long* slabs, unsigned long* tasks);
+
+//Array Binary Heap Functions-------------------------------
+struct task* array_heap_pull_task(struct thread_pool* pool);
+void array_heap_push_task(struct task* to_add, struct thread_pool* pool);
+void array_heap_push_batch(struct task* to_add[], int n, struct thread_pool* pool);
+void array_heap_update_task(struct task* to_update, int64_t priority, struct thread_pool* pool);
+void array_heap_remove_task(struct task* to_remove, struct thread_pool* pool);
+
+//8-ary Heap Functions--------------------------------------
+struct task* dary_pull_task(struct thread_pool* pool);
+void dary_push_task(struct task* to_add, struct thread_pool* pool);
+void dary_push_batch(struct task* to_add[], int n, struct thread_pool* pool);
+void dary_update_task(struct task* to_update, int64_t priority, struct thread_pool* pool);
+void dary_remove_task(struct task* to_remove, struct thread_pool* pool);
 
 //Binomial Heap Functions-----------------------------------
 struct task* binomial_pull_task(struct thread_pool* pool);
 void binomial_push_task(struct task* to_add, struct thread_pool* pool);
+void binomial_push_batch(struct task* to_add[], int n, struct thread_pool* pool);
+void binomial_update_task(struct task* to_update, int64_t priority, struct thread_pool* pool);
+void binomial_remove_task(struct task* to_remove, struct thread_pool* pool);
+
+//Lazy Binomial Heap Functions------------------------------
+struct task* lazy_binomial_pull_task(struct thread_pool* pool);
+void lazy_binomial_push_task(struct task* to_add, struct thread_pool* pool);
+void lazy_binomial_update_task(struct task* to_update, int64_t priority, struct thread_pool* pool);
+void lazy_binomial_remove_task(struct task* to_remove, struct thread_pool* pool);
 
 //Binary Heap Functions-------------------------------------
 struct task* binary_pull_task(struct thread_pool* pool);
 void binary_push_task(struct task* to_add, struct thread_pool* pool);
+void binary_push_batch(struct task* to_add[], int n, struct thread_pool* pool);
+void binary_update_task(struct task* to_update, int64_t priority, struct thread_pool* pool);
+void binary_remove_task(struct task* to_remove, struct thread_pool* pool);
 
 //Fibonacci Heap Functions----------------------------------
 struct task* fibonacci_pull_task(struct thread_pool* pool);
 void fibonacci_push_task(struct task* to_add, struct thread_pool* pool);
+void fibonacci_push_batch(struct task* to_add[], int n, struct thread_pool* pool);
+void fibonacci_update_task(struct task* to_update, int64_t priority, struct thread_pool* pool);
+void fibonacci_remove_task(struct task* to_remove, struct thread_pool* pool);
 
 //FIFO Functions---------------------------------------------
 struct task* FIFO_pull_task(struct thread_pool* pool);
 void FIFO_push_task(struct task* to_add, struct thread_pool* pool);
+void FIFO_remove_task(struct task* to_remove, struct thread_pool* pool);
 
 //LIFO Functions---------------------------------------------
 struct task* LIFO_pull_task(struct thread_pool* pool);
 void LIFO_push_task(struct task* to_add, struct thread_pool* pool);
+void LIFO_remove_task(struct task* to_remove, struct thread_pool* pool);
+
+//Work Stealing Functions------------------------------------
+struct task* ws_FIFO_pull_task(struct thread_pool* pool);
+struct task* ws_LIFO_pull_task(struct thread_pool* pool);
+void ws_push_task(struct task* to_add, struct thread_pool* pool);
+struct thread_info* ws_next_inbox(struct thread_pool* pool, struct thread_info* target);
+void ws_push_batch(struct task* to_add[], int n, struct thread_pool* pool);
+
+//Ring Buffer Functions--------------------------------------
+struct task* ring_pull_task(struct thread_pool* pool);
+void ring_push_task(struct task* to_add, struct thread_pool* pool);
+
+//Bucket Queue Functions-------------------------------------
+struct task* bucket_pull_task(struct thread_pool* pool);
+void bucket_push_task(struct task* to_add, struct thread_pool* pool);
+void bucket_update_task(struct task* to_update, int64_t priority, struct thread_pool* pool);
+void bucket_remove_task(struct task* to_remove, struct thread_pool* pool);
 
 
 //==================================================================
@@ -62,15 +331,30 @@ decide the priority of tasks
 
 ---'modify_pool' is the mutex that allows only access to the pool by
       one of the created threads at a time. 
----'signal_change' is the broadcast that tells the threads that either
-      a new task has been added to the queue or threads should be
-      terminated.
+---'idle_stack' holds the sleeping threads, most recently idle on 
+      top. Each waits on its own condition variable so a new task 
+      wakes exactly one thread. Every thread is woken when the threads
+      should be terminated.
 ---'kill_immediately' flag tells the threads to terminate as soon as
       the execution of the current task is complete. It will also
       terminate any idle theads.
 ---'kill_when_idle' flags tells the threads to terminate when idle.
       This allows the threads to continue working on the queue until
       empty.
+---'num_idle_threads' counts the threads on idle_stack along with any
+      about to go there. In the lock-free modes it lets adding a task
+      skip modify_pool when no thread needs waking.
+---'cache_key' holds each thread's task_cache for the pool, so that
+      the cache is orphaned when the thread exits.
+---'cpus' are the CPUs the threads are pinned to, one each in turn 
+      or all of them if 'pin_each' is 0.
+---'neighbours' are the pools of the other NUMA nodes of a numa_pool,
+      nearest first, which idle threads steal from.
+---'number_threads' counts the threads that have not left the pool.
+      'threads_to_remove' of them leave as soon as they are between 
+      tasks. With a 'keep_alive_ms' threads idle for that long leave 
+      while more than 'min_threads' remain, and with a 'max_threads'
+      threads are added while tasks pile up.
 */
 struct thread_pool* create_pool(int number_threads, int mode, int (*function)(const void* p1, const void* p2)){
   
@@ -81,25 +365,64 @@ struct thread_pool* create_pool(int number_threads, int mode, int (*function)(co
     return NULL;
   }
 
+  if(pthread_key_create(&pool->cache_key, orphan_task_cache) != 0){
+    printf("ERROR: Could not create the key of the task caches\n");
+    free(pool);
+    return NULL;
+  }
+
   set_queue_mode(pool, mode);
   
   pthread_mutex_init(&pool->modify_pool, NULL);
-  pthread_cond_init(&pool->signal_change, NULL);
+
+  pthread_mutex_init(&pool->modify_caches, NULL);
+  pool->pool_id = atomic_fetch_add(&next_pool_id, 1);
+  pool->caches = NULL;
+  pool->slabs_allocated = 0;
+  pool->tasks_allocated = 0;
 
   pool->thread_list = NULL;
-  
-  pool->number_threads = number_threads;
-  add_threads(number_threads, pool);
+  pool->inbox_cursor = NULL;
   
   pool->head = NULL;
   pool->tail = NULL;
   
   pool->num_tasks_in_queue = 0;
+  pool->num_idle_threads = 0;
+  pool->idle_stack = NULL;
+  pool->idle_policy = 1;
+  pool->num_spinning = 0;
+  pool->spin_hits = 0;
+  pool->spin_misses = 0;
  
   pool->kill_immediately = 0;
   pool->kill_when_idle = 0;
   
   pool->comp_function = function;
+
+  atomic_init(&pool->idle_waiting, 0);
+
+  pool->cpus = NULL;
+  pool->num_cpus = 0;
+  pool->pin_each = 1;
+  pool->next_cpu = 0;
+  pool->numa = NULL;
+  pool->node = 0;
+  pool->neighbours = NULL;
+  pool->num_neighbours = 0;
+
+  pool->threads_to_remove = 0;
+  pool->min_threads = 0;
+  pool->max_threads = 0;
+  pool->keep_alive_ms = 0;
+  pool->next_scale = 0;
+
+  pool->latency_classes = 0;
+
+  //the threads start running immediately so the pool must be fully
+  //initialized first
+  pool->number_threads = 0;
+  add_threads(number_threads, pool);
   
   return pool;
 }
@@ -112,39 +435,149 @@ struct thread_pool* create_pool(int number_threads, int mode, int (*function)(co
   3. Fibonacci Heap
   4. First In First Out Queue
   5. Last In First Out Queue
+  6. Work Stealing Deques, oldest task first on each thread
+  7. Work Stealing Deques, newest task first on each thread
+  8. Lock-free Ring Buffer of RING_BUFFER_CAPACITY tasks
+  9. Binary Heap stored in an array
+  10. 8-ary Heap ordered by the priority given to add_task_with_priority
+  11. Bucket Queue of the priorities 0 to 255 given to add_task_with_priority
+  12. Lazy Binomial Heap, which only links its trees when a task is pulled
+
+  The work stealing and ring buffer modes set 'lock_free' since their
+  push and pull functions do not need modify_pool. Modes that can add
+  many tasks faster than one at a time set 'push_batch'. Modes that
+  order tasks by priority set 'update', which moves a queued task whose
+  priority changed. The locked modes set 'remove', which takes a task
+  out from anywhere in the queue.
 */
 void set_queue_mode(struct thread_pool* pool, int mode){
 
+  pool->lock_free = 0;
+  pool->ring = NULL;
+  pool->buckets = NULL;
+  pool->heap_array = NULL;
+  pool->heap_capacity = 0;
+  pool->dary_keys = NULL;
+  pool->dary_tasks = NULL;
+  pool->dary_capacity = 0;
+  for(int i=0; i<DEGREE_TABLE_SIZE; i++){
+    pool->degree_table[i] = NULL;
+  }
+  pool->lazy_max = NULL;
+  pool->push_batch = NULL;
+  pool->update = NULL;
+  pool->remove = NULL;
+
   switch(mode){
   case 1:
     pool->push = binary_push_task;
     pool->pull = binary_pull_task;
+    pool->push_batch = binary_push_batch;
+    pool->update = binary_update_task;
+    pool->remove = binary_remove_task;
     break;
     
   case 2:
     pool->push = binomial_push_task;
     pool->pull = binomial_pull_task;
+    pool->push_batch = binomial_push_batch;
+    pool->update = binomial_update_task;
+    pool->remove = binomial_remove_task;
     break;
 
   case 3:
     pool->push = fibonacci_push_task;
     pool->pull = fibonacci_pull_task;
+    pool->push_batch = fibonacci_push_batch;
+    pool->update = fibonacci_update_task;
+    pool->remove = fibonacci_remove_task;
     break;
 
   case 4:
     pool->push = FIFO_push_task;
     pool->pull = FIFO_pull_task;
+    pool->remove = FIFO_remove_task;
     break;
 
   case 5:
     pool->push = LIFO_push_task;
     pool->pull = LIFO_pull_task;
+    pool->remove = LIFO_remove_task;
+    break;
+
+  case 6:
+    pool->push = ws_push_task;
+    pool->pull = ws_FIFO_pull_task;
+    pool->push_batch = ws_push_batch;
+    pool->lock_free = 1;
+    break;
+
+  case 7:
+    pool->push = ws_push_task;
+    pool->pull = ws_LIFO_pull_task;
+    pool->push_batch = ws_push_batch;
+    pool->lock_free = 1;
+    break;
+
+  case 8:
+    pool->ring = ring_create(RING_BUFFER_CAPACITY);
+    if(pool->ring == NULL){
+      printf("Default to FIFO Queue\n");
+      pool->push = FIFO_push_task;
+      pool->pull = FIFO_pull_task;
+      pool->remove = FIFO_remove_task;
+      break;
+    }
+    pool->push = ring_push_task;
+    pool->pull = ring_pull_task;
+    pool->lock_free = 1;
+    break;
+
+  case 9:
+    pool->push = array_heap_push_task;
+    pool->pull = array_heap_pull_task;
+    pool->push_batch = array_heap_push_batch;
+    pool->update = array_heap_update_task;
+    pool->remove = array_heap_remove_task;
+    break;
+
+  case 10:
+    pool->push = dary_push_task;
+    pool->pull = dary_pull_task;
+    pool->push_batch = dary_push_batch;
+    pool->update = dary_update_task;
+    pool->remove = dary_remove_task;
+    break;
+
+  case 11:
+    pool->buckets = bucket_create();
+    if(pool->buckets == NULL){
+      printf("Default to FIFO Queue\n");
+      pool->push = FIFO_push_task;
+      pool->pull = FIFO_pull_task;
+      pool->remove = FIFO_remove_task;
+      break;
+    }
+    pool->push = bucket_push_task;
+    pool->pull = bucket_pull_task;
+    pool->update = bucket_update_task;
+    pool->remove = bucket_remove_task;
+    break;
+
+  case 12:
+    pool->push = lazy_binomial_push_task;
+    pool->pull = lazy_binomial_pull_task;
+    pool->update = lazy_binomial_update_task;
+    pool->remove = lazy_binomial_remove_task;
     break;
 
   default:
-    printf("ERROR: mode selection must be integer between 1 and 5.\nDefault to Binary Heap");
+    printf("ERROR: mode selection must be integer between 1 and 12.\nDefault to Binary Heap");
     pool->push = binary_push_task;
     pool->pull = binary_pull_task;
+    pool->push_batch = binary_push_batch;
+    pool->update = binary_update_task;
+    pool->remove = binary_remove_task;
 
     break;
   }
@@ -155,24 +588,64 @@ void set_queue_mode(struct thread_pool* pool, int mode){
 
 /*
   Creates a new thread and adds to thread_list maintained in the 
-thread pool.
+thread pool. The thread_info of a thread that has left the pool is 
+reused if there is one; its deque and inbox are kept as they are
+since other threads may still steal from them. The caller holds 
+modify_pool.
  */
 void create_thread(struct thread_pool* pool){
 
-  struct thread_info* temp = malloc(sizeof(struct thread_info));
+  struct thread_info* temp = pool->thread_list;
 
-  if(temp == NULL){
-    printf("ERROR: %s\n", strerror(errno));
+  while(temp != NULL && atomic_load(&temp->state) != THREAD_EXITED){
+    temp = temp->next;
   }
+
+  if(temp == NULL){
+
+    temp = malloc(sizeof(struct thread_info));
+
+    if(temp == NULL){
+      printf("ERROR: %s\n", strerror(errno));
+      return;
+    }
      
-  temp->pool = pool;
+    temp->pool = pool;
+
+    if(!ws_deque_init(&temp->deque)){
+      free(temp);
+      return;
+    }
+    pthread_mutex_init(&temp->inbox_lock, NULL);
+    temp->inbox_head = NULL;
+    temp->inbox_tail = NULL;
+    temp->seed = (unsigned int)(uintptr_t)temp | 1;
+    pthread_cond_init(&temp->wake, NULL);
+
+    temp->next = pool->thread_list;
+    pool->thread_list = temp;
+  }
+
+  temp->woken = 0;
+  temp->next_idle = NULL;
+  temp->spin_budget = SPIN_INITIAL;
+  atomic_store(&temp->cache, NULL);
+  atomic_store(&temp->state, THREAD_RUNNING);
 
   if(pthread_create(&temp->thread, NULL, do_work, temp) != 0){
     printf("ERROR: %s\n", strerror(errno));
+    atomic_store(&temp->state, THREAD_EXITED);
+    return;
   }
 
-  temp->next = pool->thread_list;
-  pool->thread_list = temp;
+  pin_thread(pool, temp->thread, pool->next_cpu);
+  pool->next_cpu++;
+
+  pool->number_threads++;
+
+  if(pool->inbox_cursor == NULL){
+    pool->inbox_cursor = temp;
+  }
 
   return;
 }
@@ -197,217 +670,3519 @@ void add_threads(int number_to_add, struct thread_pool* pool){
     create_thread(pool);   
   }
 
-  pool->number_threads = pool->number_threads + number_to_add;
+  //hand tasks added to a work stealing pool with no threads to the
+  //newest thread
+  if(pool->push == ws_push_task && pool->thread_list != NULL){
+    while(pool->head != NULL){
+      ws_inbox_push(pool->thread_list, FIFO_pull_task(pool));
+    }
+  }
   
   pthread_mutex_unlock(&pool->modify_pool);
   
   return;
 }
-  
-void add_task(struct thread_pool* pool, void (*function)(void* arg), void* arg){
+
+/*
+  Removes number_to_remove threads from the thread pool, or every 
+thread if there are fewer. Busy threads leave once their current task
+is done and idle threads are woken to leave at once, so this returns
+without waiting for them. Tasks already in the queue are left for the
+remaining threads.
+*/
+void remove_threads(int number_to_remove, struct thread_pool* pool){
 
   if(pool == NULL){
-    printf("ERROR: First parameter is not a valid thread_pool\n");
+    printf("ERROR: Parameter is not a valid thread_pool\n");
     return;
   }
-  
-  struct task* new_task = malloc(sizeof(struct task));
-  if(new_task == NULL){
-    printf("ERROR: %s\n", strerror(errno));
+
+  if(number_to_remove < 0){
+    printf("ERROR: Cannot remove %d threads from thread pool\n", number_to_remove);
+    return;
   }
-  
-  new_task->function = function;
-  new_task->arg = arg;
 
   pthread_mutex_lock(&pool->modify_pool);
-  
-  pool->num_tasks_in_queue++;
 
-  pool->push(new_task, pool);
-  
-  //signal to thread pool that a new task is available
-  //this will wake up an idling thread if one is available
-  pthread_cond_broadcast(&pool->signal_change);
+  int remaining = pool->number_threads - pool->threads_to_remove;
+  if(number_to_remove > remaining){
+    number_to_remove = remaining;
+  }
+
+  pool->threads_to_remove = pool->threads_to_remove + number_to_remove;
+  wake_threads(pool, number_to_remove);
+
   pthread_mutex_unlock(&pool->modify_pool);
-  
+
   return;
 }
 
 /*
-  Return pointer to the highest priority task in queue if queue is 
-Binary Heap, Binomial Heap, or Fibonacci Heap. If queue is  FIFO 
-queue it returns a pointer to the oldest task. If LIFO it returns 
-the newest task in the queue.
+  Lets the pool grow and shrink with its load. A thread is added while
+tasks pile up faster than the threads run them, up to 'max_threads'.
+A thread idle for 'keep_alive_ms' leaves while more than 'min_threads'
+remain. A 'max_threads' of 0 never adds threads and a 'keep_alive_ms'
+of 0 never removes them.
 */
-struct task* pull_task(struct thread_pool* pool){
+void pool_set_autoscale(struct thread_pool* pool, int min_threads, int max_threads, long keep_alive_ms){
 
-  if(pool->num_tasks_in_queue == 0){
-    
-    return NULL;
+  if(pool == NULL){
+    printf("ERROR: Parameter is not a valid thread_pool\n");
+    return;
   }
 
-  else{
-
-    struct task* to_do;
-  
-    to_do = pool->pull(pool);
-    pool->num_tasks_in_queue--;
-    
-   
-    return to_do;
+  if(min_threads < 0 || max_threads < 0 || keep_alive_ms < 0 || (max_threads > 0 && max_threads < min_threads)){
+    printf("ERROR: Invalid bounds for autoscaling\n");
+    return;
   }
-}
-
-/*This is the thread where the work of the threads is accomplished.
-It is infinite loop that can only be broken when either the 
-kill_immediately or kill_when_idle flag is set. Otherwise the loop
-look for a task in the queue and execute it. Failing this it will wait
-until it receives a signal that a task is available of one of the kill
-flags has been flipped.
-*/ 
-void* do_work(void* parameter){
-
-  struct thread_info* a = (struct thread_info*)(parameter);
-  struct task* to_do;
-
-  struct thread_pool* pool = a->pool;
-  
-  while(1){
-
-    pthread_mutex_lock(&pool->modify_pool);
-
-    if(pool->kill_immediately == 1){
-      pthread_mutex_unlock(&pool->modify_pool);
-      return NULL;
-    }
-
-    //Put thread to sleep while waits for more work
-    while(pool->num_tasks_in_queue == 0){
 
-      if(pool->kill_when_idle == 1){
+  pool->min_threads = min_threads;
+  pool->max_threads = max_threads;
+  pool->keep_alive_ms = keep_alive_ms;
 
-	pthread_mutex_unlock(&pool->modify_pool);
-	return NULL;
-      }
+  //threads already asleep only see the keep-alive once woken
+  pthread_mutex_lock(&pool->modify_pool);
+  wake_threads(pool, pool->number_threads);
+  pthread_mutex_unlock(&pool->modify_pool);
 
-      pthread_cond_wait(&pool->signal_change, &pool->modify_pool);
+  return;
+}
 
-       if(pool->kill_immediately == 1){
+/*
+  Called after tasks are added. Adds a thread if autoscaling is on, no
+thread is idle, there are fewer than max_threads and the tasks not yet
+finished are more than AUTOSCALE_BACKLOG per thread. Only one thread 
+is added per AUTOSCALE_INTERVAL_NS, so a backlog that lasts keeps 
+adding threads while a short burst does not.
+*/
+static void autoscale(struct thread_pool* pool){
 
-	 pthread_mutex_unlock(&pool->modify_pool);
-	 return NULL;
-       }
-    }
+  int max_threads = atomic_load_explicit(&pool->max_threads, memory_order_relaxed);
+  int threads = atomic_load_explicit(&pool->number_threads, memory_order_relaxed);
 
-    //At this point there must be a task available and the thread
-    //owns the modify_pool mutex
+  if(threads >= max_threads){
+    return;
+  }
 
-    //Grab the new task
-    to_do = pull_task(pool);
+  if(atomic_load_explicit(&pool->num_idle_threads, memory_order_relaxed) > 0 ||
+     atomic_load_explicit(&pool->num_spinning, memory_order_relaxed) > 0){
+    return;
+  }
 
-    pthread_mutex_unlock(&pool->modify_pool);
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  long now_ns = (long)now.tv_sec*1000000000L + now.tv_nsec;
+  long next_scale = atomic_load(&pool->next_scale);
 
-    //Call the function
-    to_do->function(to_do->arg);
+  if(now_ns < next_scale || !atomic_compare_exchange_strong(&pool->next_scale, &next_scale, now_ns+AUTOSCALE_INTERVAL_NS)){
+    return;
+  }
 
-    free(to_do);
-    to_do = NULL;
+  //adding up the counts of every thread is only done once an interval
+  if(pool_pending(pool) <= threads*AUTOSCALE_BACKLOG){
+    return;
+  }
 
+  pthread_mutex_lock(&pool->modify_pool);
+  if(pool->number_threads < max_threads && pool->kill_immediately == 0 && pool->kill_when_idle == 0){
+    create_thread(pool);
   }
+  pthread_mutex_unlock(&pool->modify_pool);
 
-  return NULL;
+  return;
 }
 
-//Threads complete their tasks and then close
-void close_immediately(struct thread_pool* pool){
-    
-  pthread_mutex_lock(&pool->modify_pool);
+/*
+  Called with modify_pool held by a thread that is between tasks. If 
+remove_threads asked for threads to leave and the pool is not being 
+destroyed, the thread takes one of the requests, leaves the pool and 
+1 is returned. The caller must then unlock modify_pool and exit.
+*/
+static int retire_thread(struct thread_info* self){
 
-  pool->kill_immediately = 1;
-	
-  pthread_cond_broadcast(&pool->signal_change);
+  struct thread_pool* pool = self->pool;
 
-  pthread_mutex_unlock(&pool->modify_pool);
+  if(pool->threads_to_remove == 0 || pool->kill_immediately == 1 || pool->kill_when_idle == 1){
+    return 0;
+  }
 
-  return;
+  pool->threads_to_remove--;
+  leave_pool(self);
+
+  //the thread may have been woken for a task it will now not run
+  if(pool->lock_free || pool->num_tasks_in_queue > 0){
+    wake_threads(pool, 1);
+  }
+  return 1;
 }
 
-//Flips kill_when_idle_flag and sends out signal
-void close_when_idle(struct thread_pool* pool){
+/*
+  Marks the calling thread as gone from the pool. It is detached since
+no one will join it, and the inbox cursor is moved off it. The caller
+holds modify_pool and is not on the idle stack.
+*/
+static void leave_pool(struct thread_info* self){
 
-  pthread_mutex_lock(&pool->modify_pool);
+  struct thread_pool* pool = self->pool;
 
-  pool->kill_when_idle = 1;
+  atomic_store(&self->state, THREAD_RETIRED);
+  pool->number_threads--;
+  pthread_detach(pthread_self());
 
-  pthread_cond_broadcast(&pool->signal_change);
+  if(atomic_load(&pool->inbox_cursor) == self){
+    atomic_store(&pool->inbox_cursor, ws_next_inbox(pool, self));
+  }
 
-  pthread_mutex_unlock(&pool->modify_pool);
+  //tasks left on its deque or inbox are stolen by the other threads
+  if(atomic_load(&self->deque.bottom) > atomic_load(&self->deque.top) || atomic_load(&self->inbox_head) != NULL){
+    wake_threads(pool, 1);
+  }
 
+  release_task_cache(pool);
   return;
 }
-
-/*Waits for threads to be idle (queue empty and all tasks complete)
-before closing
-*/
-void destroy_pool_when_idle(struct thread_pool* pool){
+  
+void add_task(struct thread_pool* pool, void (*function)(void* arg), void* arg){
 
   if(pool == NULL){
-    printf("ERROR: parameter is not a valid thread_pool\n");
+    printf("ERROR: First parameter is not a valid thread_pool\n");
     return;
   }
-
-  //Give the close signal to the working or idle threads
-  close_when_idle(pool);
   
-  //Free the linked list pointed to by pool->head_of_thread_info
-  struct thread_info* step_through = pool->thread_list;
-  struct thread_info* temp;
-
-  while(step_through != NULL){
+  struct task* new_task = alloc_task(pool);
+  if(new_task == NULL){
+    return;
+  }
+  
+  new_task->function = function;
+  new_task->arg = arg;
+  new_task->priority = 0;
 
-    if(pthread_join((step_through->thread), NULL) != 0){
-      printf("ERROR: %s\n", strerror(errno));
-    }     
-    
-    temp = step_through;
-    step_through = step_through->next;
-    free(temp);
-  }    
+  submit_task(pool, new_task);
   
-  free(pool);
-  pool = NULL;
   return;
 }
 
-/*Closes threads immediately.
+/*
+  Same as add_task except the task carries the integer 'priority'.
+The 8-ary Heap orders tasks by it, largest first.
 */
-void destroy_pool_immediately(struct thread_pool* pool){
+void add_task_with_priority(struct thread_pool* pool, void (*function)(void* arg), void* arg, int64_t priority){
 
   if(pool == NULL){
-    printf("ERROR: Parameter is not a valid thread_pool\n");
+    printf("ERROR: First parameter is not a valid thread_pool\n");
     return;
   }
-   
-  //stop the threads from idling or finish when done with current task
-  close_immediately(pool);
 
-  //free the linked list pointed to by pool->head_of_thread_info
-  struct thread_info* step_through = pool->thread_list;
-  struct thread_info* temp;
+  struct task* new_task = alloc_task(pool);
+  if(new_task == NULL){
+    return;
+  }
 
-  while(step_through != NULL){
+  new_task->function = function;
+  new_task->arg = arg;
+  new_task->priority = priority;
 
-    if(pthread_join((step_through->thread), NULL) != 0){
+  submit_task(pool, new_task);
+
+  return;
+}
+
+/*
+  Places an allocated task in the queue and wakes one idle thread if
+there is one.
+*/
+void submit_task(struct thread_pool* pool, struct task* new_task){
+
+  struct task_cache* cache = new_task->cache;
+
+  atomic_fetch_add_explicit(&cache->tasks_submitted, 1, memory_order_relaxed);
+  STAT_ADD(&cache->stats, tasks_added, 1);
+  latency_stamp(pool, &new_task, 1);
+
+  if(pool->lock_free){
+
+    pool->push(new_task, pool);
+    STAT_MAX(&cache->stats, max_queue_depth, lock_free_depth(pool));
+
+    //pairs with the increment in lock_free_get_task. Either the idle
+    //thread finds the task or it is seen here and woken
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load_explicit(&pool->num_idle_threads, memory_order_relaxed) > 0){
+      lock_pool(pool, cache);
+      wake_threads(pool, 1);
+      unlock_pool(pool, cache);
+    }
+    else if(pool->num_neighbours > 0){
+      wake_neighbour(pool);
+    }
+    autoscale(pool);
+    return;
+  }
+
+  int remote = 0;
+
+  lock_pool(pool, cache);
+  
+  pool->num_tasks_in_queue++;
+  STAT_MAX(&cache->stats, max_queue_depth, pool->num_tasks_in_queue);
+
+  new_task->queued = 1;
+  pool->push(new_task, pool);
+  
+  //wake up one idling thread if one is available and the spinning
+  //threads are not enough to take every task in the queue. Without 
+  //one, a thread of the nearest NUMA node is woken to steal it
+  if(pool->num_tasks_in_queue > (unsigned int)atomic_load(&pool->num_spinning)){
+    remote = (pool->idle_stack == NULL);
+    wake_threads(pool, 1);
+  }
+  unlock_pool(pool, cache);
+
+  if(remote && pool->num_neighbours > 0){
+    wake_neighbour(pool);
+  }
+  
+  autoscale(pool);
+  return;
+}
+
+/*
+  Adds 'n' tasks at once. Task i runs functions[i] with args[i]. The
+tasks are all allocated first and then placed in the queue while 
+holding modify_pool a single time. Only as many sleeping threads as
+there are new tasks are woken.
+*/
+void add_tasks(struct thread_pool* pool, void (*functions[])(void* arg), void* args[], int n){
+
+  if(pool == NULL){
+    printf("ERROR: First parameter is not a valid thread_pool\n");
+    return;
+  }
+
+  if(n <= 0){
+    return;
+  }
+
+  struct task** tasks = malloc(n*sizeof(struct task*));
+  if(tasks == NULL){
+    printf("ERROR: %s\n", strerror(errno));
+    return;
+  }
+
+  for(int i=0; i<n; i++){
+
+    tasks[i] = alloc_task(pool);
+    if(tasks[i] == NULL){
+      for(int j=0; j<i; j++){
+	free_task(tasks[j], pool);
+      }
+      free(tasks);
+      return;
+    }
+
+    tasks[i]->function = functions[i];
+    tasks[i]->arg = args[i];
+    tasks[i]->priority = 0;
+  }
+
+  submit_tasks(pool, tasks, n);
+
+  free(tasks);
+  return;
+}
+
+/*
+  Same as add_tasks except every task runs 'function'. Task i is given
+args[i].
+*/
+void add_tasks_one_function(struct thread_pool* pool, void (*function)(void* arg), void* args[], int n){
+
+  if(pool == NULL){
+    printf("ERROR: First parameter is not a valid thread_pool\n");
+    return;
+  }
+
+  if(n <= 0){
+    return;
+  }
+
+  struct task** tasks = malloc(n*sizeof(struct task*));
+  if(tasks == NULL){
+    printf("ERROR: %s\n", strerror(errno));
+    return;
+  }
+
+  for(int i=0; i<n; i++){
+
+    tasks[i] = alloc_task(pool);
+    if(tasks[i] == NULL){
+      for(int j=0; j<i; j++){
+	free_task(tasks[j], pool);
+      }
+      free(tasks);
+      return;
+    }
+
+    tasks[i]->function = function;
+    tasks[i]->arg = args[i];
+    tasks[i]->priority = 0;
+  }
+
+  submit_tasks(pool, tasks, n);
+
+  free(tasks);
+  return;
+}
+
+/*
+  Places 'n' allocated tasks in the queue. Uses the mode's push_batch
+if it has one and otherwise pushes the tasks one at a time, either 
+way under a single acquisition of modify_pool for the locked modes.
+*/
+void submit_tasks(struct thread_pool* pool, struct task* tasks[], int n){
+
+  struct task_cache* cache = tasks[0]->cache;
+
+  atomic_fetch_add_explicit(&cache->tasks_submitted, n, memory_order_relaxed);
+  STAT_ADD(&cache->stats, tasks_added, n);
+  latency_stamp(pool, tasks, n);
+
+  if(pool->lock_free){
+
+    if(pool->push_batch != NULL){
+      pool->push_batch(tasks, n, pool);
+    }
+    else{
+      for(int i=0; i<n; i++){
+	pool->push(tasks[i], pool);
+      }
+    }
+    STAT_MAX(&cache->stats, max_queue_depth, lock_free_depth(pool));
+
+    //see add_task
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load_explicit(&pool->num_idle_threads, memory_order_relaxed) > 0){
+      lock_pool(pool, cache);
+      wake_threads(pool, n);
+      unlock_pool(pool, cache);
+    }
+    else if(pool->num_neighbours > 0){
+      wake_neighbour(pool);
+    }
+    autoscale(pool);
+    return;
+  }
+
+  int remote = 0;
+
+  lock_pool(pool, cache);
+
+  if(pool->push_batch != NULL){
+    pool->num_tasks_in_queue = pool->num_tasks_in_queue + n;
+    pool->push_batch(tasks, n, pool);
+  }
+  else{
+    for(int i=0; i<n; i++){
+      pool->num_tasks_in_queue++;
+      pool->push(tasks[i], pool);
+    }
+  }
+  STAT_MAX(&cache->stats, max_queue_depth, pool->num_tasks_in_queue);
+
+  //spinning threads take some of the tasks without being woken. A
+  //spinning thread that has already found a task is not counted
+  int to_wake = n - atomic_load(&pool->num_spinning);
+  remote = (to_wake > 0 && pool->idle_stack == NULL);
+  wake_threads(pool, to_wake);
+
+  unlock_pool(pool, cache);
+
+  if(remote && pool->num_neighbours > 0){
+    wake_neighbour(pool);
+  }
+  autoscale(pool);
+  return;
+}
+
+/*
+  Pops at most 'n' threads off the idle stack and wakes each of them.
+The caller holds modify_pool.
+*/
+void wake_threads(struct thread_pool* pool, int n){
+
+  struct thread_info* to_wake;
+
+  for(int i=0; i<n && pool->idle_stack != NULL; i++){
+
+    to_wake = pool->idle_stack;
+    pool->idle_stack = to_wake->next_idle;
+    to_wake->next_idle = NULL;
+
+    to_wake->woken = 1;
+    atomic_fetch_sub(&pool->num_idle_threads, 1);
+    pthread_cond_signal(&to_wake->wake);
+  }
+  return;
+}
+
+/*
+  Pushes the calling thread onto the idle stack and sleeps until 
+another thread pops it off with wake_threads. The caller holds 
+modify_pool and has already counted the thread in num_idle_threads;
+wake_threads removes it from the count.
+  With a keep-alive time the thread only sleeps that long. If it is 
+still not woken and more than min_threads threads remain, and more 
+than one, it takes itself off the idle stack and 1 is returned. The 
+caller then leaves the pool unless there is work after all. Returns 0
+otherwise.
+*/
+int park_thread(struct thread_info* self){
+
+  struct thread_pool* pool = self->pool;
+  long keep_alive = atomic_load(&pool->keep_alive_ms);
+  struct timespec deadline;
+
+  self->woken = 0;
+  self->next_idle = pool->idle_stack;
+  pool->idle_stack = self;
+
+  //modify_pool is not held while the thread sleeps
+  STAT_UNLOCKED(self->cache);
+
+  if(keep_alive <= 0){
+    while(self->woken == 0){
+      pthread_cond_wait(&self->wake, &pool->modify_pool);
+    }
+    STAT_LOCKED(self->cache);
+    return 0;
+  }
+
+  while(self->woken == 0){
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += keep_alive/1000;
+    deadline.tv_nsec += (keep_alive%1000)*1000000;
+    if(deadline.tv_nsec >= 1000000000){
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+
+    int result = 0;
+    while(self->woken == 0 && result != ETIMEDOUT){
+      result = pthread_cond_timedwait(&self->wake, &pool->modify_pool, &deadline);
+    }
+
+    //a thread that must stay sleeps for another keep-alive period
+    if(self->woken == 1 || pool->number_threads <= pool->min_threads || pool->number_threads <= 1 || 
+       pool->kill_immediately == 1 || pool->kill_when_idle == 1){
+      continue;
+    }
+
+    struct thread_info** link = &pool->idle_stack;
+    while(*link != self){
+      link = &((*link)->next_idle);
+    }
+    (*link) = self->next_idle;
+    self->next_idle = NULL;
+    atomic_fetch_sub(&pool->num_idle_threads, 1);
+    STAT_LOCKED(self->cache);
+    return 1;
+  }
+  STAT_LOCKED(self->cache);
+  return 0;
+}
+
+/*
+  Return pointer to the highest priority task in queue if queue is 
+Binary Heap, Binomial Heap, or Fibonacci Heap. If queue is  FIFO 
+queue it returns a pointer to the oldest task. If LIFO it returns 
+the newest task in the queue.
+*/
+struct task* pull_task(struct thread_pool* pool){
+
+  if(pool->num_tasks_in_queue == 0){
+    
+    return NULL;
+  }
+
+  else{
+
+    struct task* to_do;
+  
+    to_do = pool->pull(pool);
+    pool->num_tasks_in_queue--;
+    to_do->queued = 0;
+    
+   
+    return to_do;
+  }
+}
+
+/*
+  Finds the next task for the calling thread when the queue mode does
+not need modify_pool. The queues are searched without the lock first,
+then those of the other NUMA nodes, in which case '*owner' is set to 
+the pool the task came from.
+If nothing is found the thread takes modify_pool, counts itself in
+num_idle_threads and searches once more before parking. A task added
+after that search sees num_idle_threads > 0 and wakes a thread. 
+Returns NULL when the thread should terminate.
+*/
+struct task* lock_free_get_task(struct thread_info* self, struct thread_pool** owner){
+
+  struct thread_pool* pool = self->pool;
+  struct task* to_do;
+
+  (*owner) = pool;
+
+  if(pool->kill_immediately == 1){
+    return NULL;
+  }
+
+  to_do = pool->pull(pool);
+  if(to_do != NULL){
+    return to_do;
+  }
+
+  if(pool->num_neighbours > 0){
+    to_do = steal_remote_task(self, owner);
+    if(to_do != NULL){
+      return to_do;
+    }
+  }
+
+  to_do = spin_for_task(self);
+  if(to_do != NULL){
+    return to_do;
+  }
+
+  lock_pool(pool, self->cache);
+
+  while(1){
+
+    if(pool->kill_immediately == 1 || retire_thread(self)){
+      to_do = NULL;
+      break;
+    }
+
+    atomic_fetch_add(&pool->num_idle_threads, 1);
+
+    to_do = pool->pull(pool);
+    if(to_do != NULL || pool->kill_when_idle == 1){
+      atomic_fetch_sub(&pool->num_idle_threads, 1);
+      break;
+    }
+
+    //idle for the keep-alive time, so leave unless a task came in
+    if(park_thread(self)){
+      to_do = pool->pull(pool);
+      if(to_do == NULL){
+	leave_pool(self);
+      }
+      break;
+    }
+
+    //another node with no idle threads of its own may have woken this
+    //one. Its lock is not taken while holding this pool's
+    if(pool->num_neighbours > 0){
+      unlock_pool(pool, self->cache);
+      to_do = steal_remote_task(self, owner);
+      if(to_do != NULL){
+	return to_do;
+      }
+      lock_pool(pool, self->cache);
+    }
+  }
+
+  unlock_pool(pool, self->cache);
+
+  return to_do;
+}
+
+/*
+  Looks for a task without sleeping before the calling thread parks.
+With idle policy 1 it returns NULL at once. With policy 2 the queue is
+checked up to spin_budget times with a pause in between and then
+IDLE_YIELDS more times with sched_yield, and the budget is adapted to
+whether this found a task. With policy 3 it only returns once it has a
+task or one of the kill flags is set. The thread is counted in 
+num_spinning while it looks, which lets add_task skip waking a parked
+thread. Returns NULL when the caller should go on to park.
+*/
+static struct task* spin_for_task(struct thread_info* self){
+
+  struct thread_pool* pool = self->pool;
+  struct task* to_do = NULL;
+  int policy = pool->idle_policy;
+
+  if(policy != 2 && policy != 3){
+    return NULL;
+  }
+
+  atomic_fetch_add(&pool->num_spinning, 1);
+
+  for(int i=0; policy == 3 || i < self->spin_budget + IDLE_YIELDS; i++){
+
+    if(pool->kill_immediately == 1 || pool->kill_when_idle == 1){
+      break;
+    }
+
+    if(pool->lock_free){
+      to_do = pool->pull(pool);
+      if(to_do != NULL){
+	atomic_fetch_sub(&pool->num_spinning, 1);
+	break;
+      }
+    }
+    else if(atomic_load_explicit(&pool->num_tasks_in_queue, memory_order_relaxed) > 0){
+      lock_pool(pool, self->cache);
+      to_do = pull_task(pool);
+      //a thread that found a task stops counting as spinning before
+      //the lock is released, so a task added next wakes a thread
+      if(to_do != NULL){
+	atomic_fetch_sub(&pool->num_spinning, 1);
+	unlock_pool(pool, self->cache);
+	break;
+      }
+      unlock_pool(pool, self->cache);
+    }
+
+    if(policy == 3 || i < self->spin_budget){
+      cpu_relax();
+    }
+    else{
+      sched_yield();
+    }
+  }
+
+  //must come before the caller checks the queue under modify_pool so 
+  //that a task added after that check wakes a thread
+  if(to_do == NULL){
+    atomic_fetch_sub(&pool->num_spinning, 1);
+  }
+
+  if(policy == 3){
+    return to_do;
+  }
+
+  if(to_do != NULL){
+    atomic_fetch_add_explicit(&pool->spin_hits, 1, memory_order_relaxed);
+    if(self->spin_budget < SPIN_MAX){
+      self->spin_budget = self->spin_budget*2;
+    }
+  }
+  else{
+    atomic_fetch_add_explicit(&pool->spin_misses, 1, memory_order_relaxed);
+    if(self->spin_budget > SPIN_MIN){
+      self->spin_budget = self->spin_budget/2;
+    }
+  }
+  return to_do;
+}
+
+//Tells the processor the thread is spinning so it can save power
+static void cpu_relax(void){
+
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+  __asm__ __volatile__("yield");
+#else
+  atomic_signal_fence(memory_order_seq_cst);
+#endif
+  return;
+}
+
+/*
+  Sets what a thread does when it runs out of work. The options are:
+
+  1. Park at once until a task is added (the default)
+  2. Spin, then yield, then park, adapting how long it spins
+  3. Spin until a task is added, never parking
+*/
+void pool_set_idle_policy(struct thread_pool* pool, int policy){
+
+  if(pool == NULL){
+    printf("ERROR: Parameter is not a valid thread_pool\n");
+    return;
+  }
+
+  if(policy < 1 || policy > 3){
+    printf("ERROR: Idle policy must be between 1 and 3\n");
+    return;
+  }
+
+  pool->idle_policy = policy;
+  return;
+}
+
+/*
+  Reports how many times an idle thread with policy 2 found a task 
+while spinning and how many times it spun without finding one and 
+parked.
+*/
+void pool_idle_stats(struct thread_pool* pool, unsigned long* hits, unsigned long* misses){
+
+  if(pool == NULL){
+    printf("ERROR: Parameter is not a valid thread_pool\n");
+    return;
+  }
+
+  if(hits != NULL){
+    (*hits) = atomic_load_explicit(&pool->spin_hits, memory_order_relaxed);
+  }
+  if(misses != NULL){
+    (*misses) = atomic_load_explicit(&pool->spin_misses, memory_order_relaxed);
+  }
+  return;
+}
+
+//Adds the counters of the thread owning 'cache' to 'snapshot'
+static void add_thread_stats(struct pool_stats* snapshot, struct task_cache* cache){
+
+#ifndef THREAD_POOL_NO_STATS
+  struct thread_stats* stats = &cache->stats;
+  unsigned long depth = atomic_load_explicit(&stats->max_queue_depth, memory_order_relaxed);
+
+  snapshot->tasks_added += atomic_load_explicit(&stats->tasks_added, memory_order_relaxed);
+  snapshot->tasks_run += atomic_load_explicit(&stats->tasks_run, memory_order_relaxed);
+  snapshot->busy_ns += atomic_load_explicit(&stats->busy_ns, memory_order_relaxed);
+  snapshot->idle_ns += atomic_load_explicit(&stats->idle_ns, memory_order_relaxed);
+  snapshot->lock_waits += atomic_load_explicit(&stats->lock_waits, memory_order_relaxed);
+  snapshot->lock_wait_ns += atomic_load_explicit(&stats->lock_wait_ns, memory_order_relaxed);
+  snapshot->lock_hold_ns += atomic_load_explicit(&stats->lock_hold_ns, memory_order_relaxed);
+  if(depth > snapshot->max_queue_depth){
+    snapshot->max_queue_depth = depth;
+  }
+#else
+  (void)snapshot;
+  (void)cache;
+#endif
+  return;
+}
+
+/*Returns the number of tasks waiting in the ring, or in the deque of
+the calling thread in the work stealing modes, for 'max_queue_depth'.
+Tasks added from outside the pool go to an inbox and are not counted.
+*/
+static unsigned long lock_free_depth(struct thread_pool* pool){
+
+  if(pool->ring != NULL){
+    return atomic_load_explicit(&pool->ring->enqueue_pos, memory_order_relaxed) - atomic_load_explicit(&pool->ring->dequeue_pos, memory_order_relaxed);
+  }
+
+  struct thread_info* self = current_worker;
+  if(self == NULL || self->pool != pool){
+    return 0;
+  }
+
+  long depth = atomic_load_explicit(&self->deque.bottom, memory_order_relaxed) - atomic_load_explicit(&self->deque.top, memory_order_relaxed);
+  return (depth > 0) ? depth : 0;
+}
+
+/*
+  Adds up the counters kept in every task_cache of the pool. The 
+caches are never freed before the pool so holding modify_caches is
+enough to read them.
+*/
+void pool_get_stats(struct thread_pool* pool, struct pool_stats* snapshot){
+
+  if(pool == NULL){
+    printf("ERROR: Parameter is not a valid thread_pool\n");
+    return;
+  }
+
+  memset(snapshot, 0, sizeof(struct pool_stats));
+
+  pthread_mutex_lock(&pool->modify_caches);
+  for(struct task_cache* cache = pool->caches; cache != NULL; cache = cache->next){
+    add_thread_stats(snapshot, cache);
+  }
+  pthread_mutex_unlock(&pool->modify_caches);
+
+  snapshot->spin_hits = atomic_load_explicit(&pool->spin_hits, memory_order_relaxed);
+  snapshot->spin_misses = atomic_load_explicit(&pool->spin_misses, memory_order_relaxed);
+  snapshot->threads = atomic_load_explicit(&pool->number_threads, memory_order_relaxed);
+  snapshot->idle_threads = atomic_load_explicit(&pool->num_idle_threads, memory_order_relaxed);
+  snapshot->tasks_pending = pool_pending(pool);
+  return;
+}
+
+/*
+  Reads the counters of each running thread. Holding modify_pool keeps
+threads from leaving or going to sleep while the list is walked.
+*/
+int pool_get_worker_stats(struct thread_pool* pool, struct pool_stats* workers, int max){
+
+  if(pool == NULL){
+    printf("ERROR: Parameter is not a valid thread_pool\n");
+    return 0;
+  }
+
+  int n = 0;
+
+  pthread_mutex_lock(&pool->modify_pool);
+  pthread_mutex_lock(&pool->modify_caches);
+
+  for(struct thread_info* t = pool->thread_list; t != NULL && n < max; t = t->next){
+
+    struct task_cache* cache = atomic_load(&t->cache);
+    if(atomic_load(&t->state) != THREAD_RUNNING || cache == NULL){
+      continue;
+    }
+
+    memset(&workers[n], 0, sizeof(struct pool_stats));
+    add_thread_stats(&workers[n], cache);
+    workers[n].threads = 1;
+
+    for(struct thread_info* idle = pool->idle_stack; idle != NULL; idle = idle->next_idle){
+      if(idle == t){
+	workers[n].idle_threads = 1;
+	break;
+      }
+    }
+
+    if(pool->pull == ws_FIFO_pull_task || pool->pull == ws_LIFO_pull_task){
+      long size = atomic_load(&t->deque.bottom) - atomic_load(&t->deque.top);
+      workers[n].tasks_pending = (size > 0) ? size : 0;
+    }
+    n++;
+  }
+
+  pthread_mutex_unlock(&pool->modify_caches);
+  pthread_mutex_unlock(&pool->modify_pool);
+  return n;
+}
+
+//Calls the function of a task pulled from the queue and frees the task
+void run_task(struct task* to_do, struct thread_pool* pool){
+
+  struct task_group* group = to_do->group;
+  struct graph_node* node = to_do->node;
+  struct task_cache* owner = to_do->cache;
+  struct task* parent = current_task;
+  unsigned long start = 0;
+  int handle = (atomic_load_explicit(&to_do->references, memory_order_relaxed) != 0);
+
+  //a task with a handle is claimed first, and skipped if it was 
+  //cancelled while it sat in a lock-free queue
+  if(handle && (atomic_fetch_or_explicit(&to_do->state, FUTURE_STARTED, memory_order_acq_rel)&FUTURE_CANCELLED)){
+    task_release(to_do);
+    return;
+  }
+
+  current_task = to_do;
+
+  if(current_worker != NULL){
+    STAT_ADD(&current_worker->cache->stats, tasks_run, 1);
+  }
+
+  int recording = (atomic_load_explicit(&pool->latency_classes, memory_order_relaxed) > 0 && !to_do->internal);
+  if(recording){
+    start = stat_clock();
+  }
+
+  if(to_do->future_function != NULL){
+    to_do->result = to_do->future_function(to_do->arg);
+  }
+  else{
+    to_do->function(to_do->arg);
+  }
+
+  if(recording){
+    record_latency(pool, to_do, start, stat_clock());
+  }
+
+  //a task is not finished until the tasks it spawned are
+  if(atomic_load_explicit(&to_do->children.pending, memory_order_acquire) != 0){
+    task_group_wait(&to_do->children);
+  }
+
+  current_task = parent;
+
+  if(handle){
+    complete_future(to_do);
+    task_release(to_do);
+  }
+  else{
+    free_task(to_do, pool);
+  }
+
+  if(node != NULL){
+    graph_node_done(node, 0);
+  }
+  if(group != NULL){
+    task_group_done(group);
+  }
+  count_finished(pool, owner);
+  return;
+}
+
+//Returns the time of CLOCK_MONOTONIC in nanoseconds
+static unsigned long stat_clock(void){
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (unsigned long)now.tv_sec*1000000000UL + now.tv_nsec;
+}
+
+/*Runs a task on one of the pool's threads. The time since its last
+task finished is counted as idle and the time running this one as 
+busy.
+*/
+static void worker_run(struct thread_info* self, struct task* to_do, struct thread_pool* owner){
+
+#ifndef THREAD_POOL_NO_STATS
+  struct thread_stats* stats = &self->cache->stats;
+  unsigned long start = stat_clock();
+
+  STAT_ADD(stats, idle_ns, start - self->last_run);
+  run_task(to_do, owner);
+  self->last_run = stat_clock();
+  STAT_ADD(stats, busy_ns, self->last_run - start);
+#else
+  (void)self;
+  run_task(to_do, owner);
+#endif
+  return;
+}
+
+/*Locks modify_pool. Only when another thread holds it is the wait
+timed and counted in the stats of 'cache'. The time it was taken is
+kept in 'cache' for unlock_pool.
+*/
+static void lock_pool(struct thread_pool* pool, struct task_cache* cache){
+
+#ifndef THREAD_POOL_NO_STATS
+  if(pthread_mutex_trylock(&pool->modify_pool) == 0){
+    STAT_LOCKED(cache);
+    return;
+  }
+
+  unsigned long start = stat_clock();
+  pthread_mutex_lock(&pool->modify_pool);
+  STAT_LOCKED(cache);
+  STAT_ADD(&cache->stats, lock_waits, 1);
+  STAT_ADD(&cache->stats, lock_wait_ns, cache->locked_at - start);
+#else
+  (void)cache;
+  pthread_mutex_lock(&pool->modify_pool);
+#endif
+  return;
+}
+
+/*Unlocks modify_pool taken with lock_pool and counts the time it was
+held in the stats of 'cache'. 'locked_at' and the lock counters are 
+only written while modify_pool is held, so a thread that takes over 
+the cache of one leaving the pool never writes them at the same time.
+*/
+static void unlock_pool(struct thread_pool* pool, struct task_cache* cache){
+
+  STAT_UNLOCKED(cache);
+  pthread_mutex_unlock(&pool->modify_pool);
+  return;
+}
+
+/*This is the thread where the work of the threads is accomplished.
+It is infinite loop that can only be broken when either the 
+kill_immediately or kill_when_idle flag is set. Otherwise the loop
+look for a task in the queue and execute it. Failing this it will wait
+until it receives a signal that a task is available of one of the kill
+flags has been flipped.
+*/ 
+void* do_work(void* parameter){
+
+  struct thread_info* a = (struct thread_info*)(parameter);
+  struct task* to_do;
+  struct thread_pool* owner;
+
+  struct thread_pool* pool = a->pool;
+
+  current_worker = a;
+  a->cache = get_task_cache(pool);
+  a->last_run = stat_clock();
+  
+  while(1){
+
+    //leave between tasks when remove_threads asks for it
+    if(atomic_load_explicit(&pool->threads_to_remove, memory_order_relaxed) > 0){
+
+      pthread_mutex_lock(&pool->modify_pool);
+      if(retire_thread(a)){
+	pthread_mutex_unlock(&pool->modify_pool);
+	atomic_store(&a->state, THREAD_EXITED);
+	return NULL;
+      }
+      pthread_mutex_unlock(&pool->modify_pool);
+    }
+
+    if(pool->lock_free){
+
+      to_do = lock_free_get_task(a, &owner);
+      if(to_do == NULL){
+	if(atomic_load(&a->state) == THREAD_RETIRED){
+	  atomic_store(&a->state, THREAD_EXITED);
+	}
+	return NULL;
+      }
+
+      worker_run(a, to_do, owner);
+      to_do = NULL;
+      continue;
+    }
+
+    //look for work without the lock before sleeping on it, on the
+    //other NUMA nodes first
+    if(pool->num_tasks_in_queue == 0){
+
+      if(pool->num_neighbours > 0){
+	to_do = steal_remote_task(a, &owner);
+	if(to_do != NULL){
+	  worker_run(a, to_do, owner);
+	  to_do = NULL;
+	  continue;
+	}
+      }
+
+      to_do = spin_for_task(a);
+      if(to_do != NULL){
+	worker_run(a, to_do, pool);
+	to_do = NULL;
+	continue;
+      }
+    }
+
+    lock_pool(pool, a->cache);
+
+    if(pool->kill_immediately == 1){
+      unlock_pool(pool, a->cache);
+      return NULL;
+    }
+
+    //Put thread to sleep while waits for more work
+    while(pool->num_tasks_in_queue == 0){
+
+      if(pool->kill_when_idle == 1){
+
+	unlock_pool(pool, a->cache);
+	return NULL;
+      }
+
+      if(retire_thread(a)){
+	unlock_pool(pool, a->cache);
+	atomic_store(&a->state, THREAD_EXITED);
+	return NULL;
+      }
+
+      atomic_fetch_add(&pool->num_idle_threads, 1);
+
+      //idle for the keep-alive time with still nothing to do
+      if(park_thread(a) && pool->num_tasks_in_queue == 0){
+	leave_pool(a);
+	unlock_pool(pool, a->cache);
+	atomic_store(&a->state, THREAD_EXITED);
+	return NULL;
+      }
+
+       if(pool->kill_immediately == 1){
+
+	 unlock_pool(pool, a->cache);
+	 return NULL;
+       }
+
+      //woken by another node with no idle threads of its own, so go
+      //back and steal from it
+      if(pool->num_tasks_in_queue == 0 && pool->num_neighbours > 0){
+	break;
+      }
+    }
+
+    if(pool->num_tasks_in_queue == 0){
+      unlock_pool(pool, a->cache);
+      continue;
+    }
+
+    //At this point there must be a task available and the thread
+    //owns the modify_pool mutex
+
+    //Grab the new task
+    to_do = pull_task(pool);
+
+    unlock_pool(pool, a->cache);
+
+    //Call the function
+    worker_run(a, to_do, pool);
+    to_do = NULL;
+
+  }
+
+  return NULL;
+}
+
+//Threads complete their tasks and then close
+void close_immediately(struct thread_pool* pool){
+    
+  pthread_mutex_lock(&pool->modify_pool);
+
+  pool->kill_immediately = 1;
+	
+  //wake every parked thread
+  wake_threads(pool, pool->number_threads);
+
+  pthread_mutex_unlock(&pool->modify_pool);
+
+  return;
+}
+
+//Flips kill_when_idle_flag and wakes every parked thread
+void close_when_idle(struct thread_pool* pool){
+
+  pthread_mutex_lock(&pool->modify_pool);
+
+  pool->kill_when_idle = 1;
+
+  wake_threads(pool, pool->number_threads);
+
+  pthread_mutex_unlock(&pool->modify_pool);
+
+  return;
+}
+
+/*Waits for threads to be idle (queue empty and all tasks complete)
+before closing
+*/
+void destroy_pool_when_idle(struct thread_pool* pool){
+
+  if(pool == NULL){
+    printf("ERROR: parameter is not a valid thread_pool\n");
+    return;
+  }
+
+  //Give the close signal to the working or idle threads
+  close_when_idle(pool);
+  
+  join_threads(pool);
+  free_pool(pool);
+  return;
+}
+
+/*Closes threads immediately.
+*/
+void destroy_pool_immediately(struct thread_pool* pool){
+
+  if(pool == NULL){
+    printf("ERROR: Parameter is not a valid thread_pool\n");
+    return;
+  }
+   
+  //stop the threads from idling or finish when done with current task
+  close_immediately(pool);
+
+  join_threads(pool);
+  free_pool(pool);
+  return;
+}
+
+/*
+  Waits for every thread of the pool to terminate. Threads that left 
+the pool were detached, so for those it waits until they are past 
+their last access to the pool.
+*/
+static void join_threads(struct thread_pool* pool){
+
+  struct thread_info* step_through = pool->thread_list;
+
+  while(step_through != NULL){
+
+    if(atomic_load(&step_through->state) == THREAD_RUNNING){
+      if(pthread_join((step_through->thread), NULL) != 0){
+	printf("ERROR: %s\n", strerror(errno));
+      }     
+    }
+    else{
+      while(atomic_load(&step_through->state) != THREAD_EXITED){
+	sched_yield();
+      }
+    }
+    
+    step_through = step_through->next;
+  }
+  return;
+}
+
+/*
+  Frees the pool once join_threads has returned. Threads still running
+may steal from a thread that already finished so nothing is freed 
+until all have been joined.
+*/
+static void free_pool(struct thread_pool* pool){
+
+  struct thread_info* step_through = pool->thread_list;
+  struct thread_info* temp;
+
+  while(step_through != NULL){
+
+    temp = step_through;
+    step_through = step_through->next;
+    ws_deque_free(&temp->deque);
+    pthread_mutex_destroy(&temp->inbox_lock);
+    pthread_cond_destroy(&temp->wake);
+    free(temp);
+  }    
+
+  ring_free(pool->ring);
+  free(pool->heap_array);
+  free(pool->dary_keys);
+  free(pool->dary_tasks);
+  free(pool->buckets);
+  free(pool->cpus);
+  free(pool->neighbours);
+  pthread_key_delete(pool->cache_key);
+  free_task_caches(pool);
+  free(pool);
+  return;
+}
+
+//========================Future Functions=========================
+
+/*
+  A future is an ordinary task whose handle is given back to the 
+caller. All of its state lives in the task itself, so waiting on it
+allocates nothing. The task holds two references, one for the handle
+and one for the run, and goes back to its task_cache when the last is
+released. Waiting threads sleep on 'state' with a futex and are only
+woken if they set FUTURE_WAITERS first, so completing a task nobody
+waits on is a single atomic or.
+*/
+
+/*
+  Adds a task that runs 'function' and keeps its return value. Returns
+a handle to wait on, or NULL if the task could not be added. The 
+handle must be given back with task_release.
+*/
+struct task* add_task_future(struct thread_pool* pool, void* (*function)(void* arg), void* arg){
+
+  if(pool == NULL){
+    printf("ERROR: First parameter is not a valid thread_pool\n");
+    return NULL;
+  }
+
+  struct task* new_task = alloc_task(pool);
+  if(new_task == NULL){
+    return NULL;
+  }
+
+  new_task->function = NULL;
+  new_task->future_function = function;
+  new_task->arg = arg;
+  new_task->priority = 0;
+  new_task->result = NULL;
+  new_task->then_function = NULL;
+  new_task->then_arg = NULL;
+  atomic_init(&new_task->state, 0);
+  atomic_init(&new_task->references, 2);
+
+  submit_task(pool, new_task);
+
+  return new_task;
+}
+
+/*
+  Marks a future as done after 'result' is set. Wakes any waiting
+threads and runs the continuation if one was attached before now.
+*/
+void complete_future(struct task* handle){
+
+  int old = atomic_fetch_or_explicit(&handle->state, FUTURE_DONE, memory_order_acq_rel);
+
+  if(old&FUTURE_WAITERS){
+    future_wake(&handle->state);
+  }
+  if(old&FUTURE_THEN){
+    handle->then_function(handle->result, handle->then_arg);
+  }
+  return;
+}
+
+/*
+  Sleeps while 'state' still holds 'expected', or until 'timeout'
+passes if it is not NULL. May return early so callers check again.
+*/
+void future_sleep(atomic_int* state, int expected, const struct timespec* timeout){
+
+#ifdef __linux__
+  syscall(SYS_futex, (int*)state, FUTEX_WAIT_PRIVATE, expected, timeout, NULL, 0);
+#else
+  sched_yield();
+#endif
+  return;
+}
+
+//Wakes every thread sleeping on 'state'
+void future_wake(atomic_int* state){
+
+#ifdef __linux__
+  syscall(SYS_futex, (int*)state, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#endif
+  return;
+}
+
+//Blocks until FUTURE_DONE is set in 'state'
+void future_wait(atomic_int* state){
+
+  int current = atomic_load_explicit(state, memory_order_acquire);
+
+  while((current&FUTURE_DONE) == 0){
+
+    if((current&FUTURE_WAITERS) == 0){
+      if(!atomic_compare_exchange_weak_explicit(state, &current, current|FUTURE_WAITERS, memory_order_acquire, memory_order_acquire)){
+	continue;
+      }
+      current = current|FUTURE_WAITERS;
+    }
+
+    future_sleep(state, current, NULL);
+    current = atomic_load_explicit(state, memory_order_acquire);
+  }
+  return;
+}
+
+//Blocks until the task has run and returns its result
+void* task_wait(struct task* handle){
+
+  future_wait(&handle->state);
+  return handle->result;
+}
+
+//Returns 1 if the task has run and 0 otherwise. Never blocks
+int task_try_wait(struct task* handle){
+
+  return (atomic_load_explicit(&handle->state, memory_order_acquire)&FUTURE_DONE) != 0;
+}
+
+/*
+  Blocks until the task has run or 'milliseconds' have passed. Returns
+1 if the task has run and 0 if the time ran out.
+*/
+int task_wait_timeout(struct task* handle, long milliseconds){
+
+  struct timespec deadline;
+  struct timespec now;
+  struct timespec remaining;
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += milliseconds/1000;
+  deadline.tv_nsec += (milliseconds%1000)*1000000;
+  if(deadline.tv_nsec >= 1000000000){
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+
+  int state = atomic_load_explicit(&handle->state, memory_order_acquire);
+
+  while((state&FUTURE_DONE) == 0){
+
+    if((state&FUTURE_WAITERS) == 0){
+      if(!atomic_compare_exchange_weak_explicit(&handle->state, &state, state|FUTURE_WAITERS, memory_order_acquire, memory_order_acquire)){
+	continue;
+      }
+      state = state|FUTURE_WAITERS;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    remaining.tv_sec = deadline.tv_sec - now.tv_sec;
+    remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+    if(remaining.tv_nsec < 0){
+      remaining.tv_sec--;
+      remaining.tv_nsec += 1000000000;
+    }
+    if(remaining.tv_sec < 0){
+      return 0;
+    }
+
+    future_sleep(&handle->state, state, &remaining);
+    state = atomic_load_explicit(&handle->state, memory_order_acquire);
+  }
+
+  return 1;
+}
+
+//Returns the result of the task, or NULL if it has not run yet
+void* task_result(struct task* handle){
+
+  if(!task_try_wait(handle)){
+    return NULL;
+  }
+  return handle->result;
+}
+
+/*
+  Calls 'function' with the task's result and 'arg' once the task has
+run. If it already has, 'function' is called right away by the caller.
+Otherwise it is called by the thread that ran the task. A task can 
+only have one continuation. The caller claims it with 
+FUTURE_THEN_CLAIMED before writing the function, and sets FUTURE_THEN
+once it is written, so two callers at once can not overwrite each 
+other and the thread that ran the task never sees half of one.
+*/
+void task_then(struct task* handle, void (*function)(void* result, void* arg), void* arg){
+
+  if(atomic_fetch_or_explicit(&handle->state, FUTURE_THEN_CLAIMED, memory_order_relaxed)&FUTURE_THEN_CLAIMED){
+    printf("ERROR: Task already has a continuation\n");
+    return;
+  }
+
+  handle->then_function = function;
+  handle->then_arg = arg;
+
+  //a cancelled task is done but never ran, so it has no continuation
+  int old = atomic_fetch_or_explicit(&handle->state, FUTURE_THEN, memory_order_acq_rel);
+  if((old&FUTURE_DONE) && (old&FUTURE_CANCELLED) == 0){
+    function(handle->result, arg);
+  }
+  return;
+}
+
+/*
+  Gives back a reference to the task. The handle returned by 
+add_task_future or add_task_with_handle must not be used after it is
+released.
+*/
+void task_release(struct task* handle){
+
+  if(atomic_fetch_sub_explicit(&handle->references, 1, memory_order_acq_rel) == 1){
+    free_task(handle, handle->cache->pool);
+  }
+  return;
+}
+
+//=====================Task Handle Functions=======================
+
+/*
+  Same as add_task_with_priority except a handle to the task is given
+back, the same kind of handle add_task_future returns. It can be 
+waited on like a future, whose result is always NULL, and in the 
+locked modes its priority can be changed with pool_update_priority
+until it is taken from the queue. The handle must be given back with
+task_release.
+*/
+struct task* add_task_with_handle(struct thread_pool* pool, void (*function)(void* arg), void* arg, int64_t priority){
+
+  if(pool == NULL){
+    printf("ERROR: First parameter is not a valid thread_pool\n");
+    return NULL;
+  }
+
+  struct task* new_task = alloc_task(pool);
+  if(new_task == NULL){
+    return NULL;
+  }
+
+  new_task->function = function;
+  new_task->arg = arg;
+  new_task->priority = priority;
+  new_task->result = NULL;
+  new_task->then_function = NULL;
+  new_task->then_arg = NULL;
+  atomic_init(&new_task->state, 0);
+  atomic_init(&new_task->references, 2);
+
+  submit_task(pool, new_task);
+
+  return new_task;
+}
+
+/*
+  Changes the priority of a task added with add_task_with_handle that
+is still in the queue. Modes with an 'update' function move the task to
+its new place. In the FIFO and LIFO modes, where the priority does not
+decide the order, it is only stored. With a comparison function the 
+task is moved according to that, so the caller changes what the 
+argument compares by before calling this. Returns 1 if the task was 
+still in the queue and 0 if a thread had already taken it.
+*/
+int pool_update_priority(struct thread_pool* pool, struct task* handle, int64_t priority){
+
+  if(pool == NULL){
+    printf("ERROR: First parameter is not a valid thread_pool\n");
+    return 0;
+  }
+
+  if(pool->lock_free){
+    printf("ERROR: The priority of a task can not be changed in a lock-free mode\n");
+    return 0;
+  }
+
+  pthread_mutex_lock(&pool->modify_pool);
+
+  int queued = handle->queued;
+  if(queued){
+    if(pool->update != NULL){
+      pool->update(handle, priority, pool);
+    }
+    else{
+      handle->priority = priority;
+    }
+  }
+
+  pthread_mutex_unlock(&pool->modify_pool);
+
+  return queued;
+}
+
+/*
+  Withdraws a task with a handle, from add_task_future or 
+add_task_with_handle, that no thread has started. In the locked modes
+the task is taken out of the queue with the mode's 'remove' function
+and goes back to its task_cache once the handle is released. In the 
+lock-free modes it can not be taken out of a deque or ring, so it is
+only marked, and the thread that pulls it skips it and frees it. Either
+way the task counts as done: pool_wait_idle does not wait for it and 
+waiting on the handle returns at once with a NULL result. Its 
+continuation is not called. Returns 1 if the task was cancelled and 0
+if it had already started or been cancelled.
+*/
+int pool_cancel(struct thread_pool* pool, struct task* handle){
+
+  if(pool == NULL){
+    printf("ERROR: First parameter is not a valid thread_pool\n");
+    return 0;
+  }
+
+  if(!pool->lock_free){
+
+    pthread_mutex_lock(&pool->modify_pool);
+
+    int queued = handle->queued;
+    if(queued){
+      pool->remove(handle, pool);
+      pool->num_tasks_in_queue--;
+      handle->queued = 0;
+    }
+
+    pthread_mutex_unlock(&pool->modify_pool);
+
+    if(!queued){
+      return 0;
+    }
+  }
+
+  //claims the task against a thread about to run it
+  int old = atomic_load_explicit(&handle->state, memory_order_relaxed);
+  do{
+    if(old&(FUTURE_STARTED|FUTURE_CANCELLED)){
+      return 0;
+    }
+  }while(!atomic_compare_exchange_weak_explicit(&handle->state, &old, old|FUTURE_CANCELLED|FUTURE_DONE, memory_order_acq_rel, memory_order_relaxed));
+
+  if(old&FUTURE_WAITERS){
+    future_wake(&handle->state);
+  }
+
+  //the reference held for the run. In the lock-free modes the thread 
+  //that reaches the task gives it back
+  struct task_cache* owner = handle->cache;
+  if(!pool->lock_free){
+    task_release(handle);
+  }
+  count_finished(pool, owner);
+  return 1;
+}
+
+//Returns 1 if the task was cancelled with pool_cancel
+int task_cancelled(struct task* handle){
+
+  return (atomic_load_explicit(&handle->state, memory_order_acquire)&FUTURE_CANCELLED) != 0;
+}
+
+//=======================Task Group Functions======================
+
+/*
+  A task group counts tasks that have been added to it and have not 
+finished running. Waiting on a group blocks until the count reaches 0
+without stopping any threads of the pool. If the waiting thread is
+itself a thread of the pool it runs queued tasks while it waits rather
+than leaving its place in the pool empty.
+*/
+
+//Creates an empty task group for tasks added to 'pool'
+struct task_group* create_task_group(struct thread_pool* pool){
+
+  if(pool == NULL){
+    printf("ERROR: First parameter is not a valid thread_pool\n");
+    return NULL;
+  }
+
+  struct task_group* group = malloc(sizeof(struct task_group));
+  if(group == NULL){
+    printf("ERROR: %s\n", strerror(errno));
+    return NULL;
+  }
+
+  group->pool = pool;
+  atomic_init(&group->pending, 0);
+  return group;
+}
+
+//Same as add_task but the task is counted by 'group'
+void add_task_to_group(struct task_group* group, void (*function)(void* arg), void* arg){
+
+  struct task* new_task = alloc_task(group->pool);
+  if(new_task == NULL){
+    return;
+  }
+
+  new_task->function = function;
+  new_task->arg = arg;
+  new_task->priority = 0;
+  new_task->group = group;
+
+  atomic_fetch_add_explicit(&group->pending, 1, memory_order_relaxed);
+  submit_task(group->pool, new_task);
+  return;
+}
+
+/*
+  Called once a task of 'group' has run. The thread that brings the 
+count to 0 while threads are waiting clears GROUP_WAITERS and wakes 
+them. Waiting threads only return once 'pending' is exactly 0, so the
+group is never touched after a waiter may have freed it, apart from the
+wake, which only uses the address.
+*/
+void task_group_done(struct task_group* group){
+
+  if(atomic_fetch_sub(&group->pending, 1) == (GROUP_WAITERS|1)){
+    atomic_fetch_and(&group->pending, ~GROUP_WAITERS);
+    future_wake(&group->pending);
+  }
+  return;
+}
+
+/*
+  Removes a task from the queue without ever sleeping. Returns NULL if
+the queue is empty or the pool is being destroyed. Only called by a 
+thread of the pool, whose stats count the time it holds the lock.
+*/
+struct task* try_pull_task(struct thread_pool* pool){
+
+  struct task_cache* cache = current_worker->cache;
+  struct task* to_do;
+
+  if(pool->kill_immediately == 1){
+    return NULL;
+  }
+
+  if(pool->lock_free){
+    return pool->pull(pool);
+  }
+
+  lock_pool(pool, cache);
+  to_do = pull_task(pool);
+  unlock_pool(pool, cache);
+
+  return to_do;
+}
+
+/*
+  Blocks until every task added to 'group' has run. A thread of the
+pool runs tasks from the queue while it waits. When the queue is empty
+it only sleeps a millisecond at a time, since the tasks it waits on may
+add more work that no other thread is free to pick up.
+*/
+void task_group_wait(struct task_group* group){
+
+  struct thread_pool* pool = group->pool;
+  struct timespec nap = {0, 1000000};
+  int helping = (current_worker != NULL && current_worker->pool == pool);
+  struct task* to_do;
+  int pending;
+
+  while(1){
+
+    pending = atomic_load(&group->pending);
+    if(pending == 0){
+      return;
+    }
+
+    if(helping){
+      to_do = try_pull_task(pool);
+      if(to_do != NULL){
+	run_task(to_do, pool);
+	continue;
+      }
+    }
+
+    if((pending&GROUP_WAITERS) == 0){
+      if(!atomic_compare_exchange_weak(&group->pending, &pending, pending|GROUP_WAITERS)){
+	continue;
+      }
+      pending = pending|GROUP_WAITERS;
+    }
+
+    future_sleep(&group->pending, pending, helping ? &nap : NULL);
+  }
+}
+
+//Frees a group. Its tasks must all have run
+void destroy_task_group(struct task_group* group){
+
+  free(group);
+  return;
+}
+
+/*
+  Counts a task of 'pool' as finished in the cache of the calling 
+thread, or in 'fallback' if it can not get one. A thread waiting in 
+pool_wait_idle sets 'idle_waiting', and is then woken to add up the 
+counts again. Nothing else is written to memory shared by the threads.
+*/
+void count_finished(struct thread_pool* pool, struct task_cache* fallback){
+
+  struct task_cache* cache = get_task_cache(pool);
+  if(cache == NULL){
+    cache = fallback;
+  }
+
+  atomic_fetch_add(&cache->tasks_finished, 1);
+  if(atomic_load(&pool->idle_waiting) != 0 && atomic_exchange(&pool->idle_waiting, 0) != 0){
+    future_wake(&pool->idle_waiting);
+  }
+  return;
+}
+
+/*
+  Returns the number of tasks added to the pool that have not finished,
+from the counts kept by each thread. The finished counts are all read
+before the added ones, so a task counted as finished is always counted
+as added.
+*/
+long pool_pending(struct thread_pool* pool){
+
+  unsigned long finished = 0;
+  unsigned long submitted = 0;
+  struct task_cache* cache;
+
+  pthread_mutex_lock(&pool->modify_caches);
+  for(cache = pool->caches; cache != NULL; cache = cache->next){
+    finished += atomic_load(&cache->tasks_finished);
+  }
+  for(cache = pool->caches; cache != NULL; cache = cache->next){
+    submitted += atomic_load(&cache->tasks_submitted);
+  }
+  pthread_mutex_unlock(&pool->modify_caches);
+
+  return (long)(submitted - finished);
+}
+
+/*
+  Blocks until every task added to the pool has run. The threads of 
+the pool keep running. Must not be called from a task of the pool.
+'idle_waiting' is set before the counts are read, so a task that 
+finishes after they are read always wakes the thread.
+*/
+void pool_wait_idle(struct thread_pool* pool){
+
+  while(1){
+
+    atomic_store(&pool->idle_waiting, 1);
+    if(pool_pending(pool) == 0){
+      return;
+    }
+    future_sleep(&pool->idle_waiting, 1, NULL);
+  }
+}
+
+/*
+  Adds a task as a child of the task running on the calling thread. The
+children of a task form a task group kept in the task itself, so 
+spawning allocates nothing beyond the child.
+*/
+void pool_spawn(struct thread_pool* pool, void (*function)(void* arg), void* arg){
+
+  if(pool == NULL){
+    printf("ERROR: First parameter is not a valid thread_pool\n");
+    return;
+  }
+
+  struct task_group* children = (current_task != NULL) ? &current_task->children : &root_children;
+
+  children->pool = pool;
+  add_task_to_group(children, function, arg);
+  return;
+}
+
+/*
+  Waits for the children spawned by the running task. A thread of the
+pool runs queued tasks, its children first in the work stealing LIFO
+mode, while it waits.
+*/
+void pool_sync(struct thread_pool* pool){
+
+  struct task_group* children = (current_task != NULL) ? &current_task->children : &root_children;
+
+  if(atomic_load_explicit(&children->pending, memory_order_acquire) != 0){
+    children->pool = pool;
+    task_group_wait(children);
+  }
+  return;
+}
+
+//=======================Task Graph Functions======================
+
+/*
+  A task graph is a set of tasks ('nodes') and edges between them. A 
+node only runs once every node with an edge to it has finished. Each 
+node counts its unfinished predecessors atomically. The thread that 
+finishes a node runs the first successor that becomes ready itself and
+adds the rest as one batch. In the work stealing modes that batch goes
+onto the thread's own deque without taking a lock. The graph is kept 
+after it has run and can be submitted again.
+*/
+
+//Creates an empty task graph for 'pool'
+struct task_graph* create_task_graph(struct thread_pool* pool){
+
+  if(pool == NULL){
+    printf("ERROR: First parameter is not a valid thread_pool\n");
+    return NULL;
+  }
+
+  struct task_graph* graph = malloc(sizeof(struct task_graph));
+  if(graph == NULL){
+    printf("ERROR: %s\n", strerror(errno));
+    return NULL;
+  }
+
+  graph->pool = pool;
+  graph->nodes = NULL;
+  graph->num_nodes = 0;
+  graph->node_capacity = 0;
+  graph->verified = 0;
+  graph->group.pool = pool;
+  atomic_init(&graph->group.pending, 0);
+  return graph;
+}
+
+/*
+  Adds a node that runs 'function' with 'arg'. Returns the id of the
+node, used to add edges, or -1 if it could not be added.
+*/
+int task_graph_add_node(struct task_graph* graph, void (*function)(void* arg), void* arg){
+
+  if(graph->num_nodes == graph->node_capacity){
+
+    int capacity = (graph->node_capacity > 0) ? graph->node_capacity*2 : 16;
+    struct graph_node* bigger = realloc(graph->nodes, capacity*sizeof(struct graph_node));
+    if(bigger == NULL){
+      printf("ERROR: %s\n", strerror(errno));
+      return -1;
+    }
+    graph->nodes = bigger;
+    graph->node_capacity = capacity;
+  }
+
+  struct graph_node* node = &graph->nodes[graph->num_nodes];
+  node->graph = graph;
+  node->function = function;
+  node->arg = arg;
+  node->successors = NULL;
+  node->num_successors = 0;
+  node->successor_capacity = 0;
+  node->in_degree = 0;
+  atomic_init(&node->pending, 0);
+
+  graph->verified = 0;
+  return graph->num_nodes++;
+}
+
+//Node 'to' will not run until node 'from' has finished
+void task_graph_add_edge(struct task_graph* graph, int from, int to){
+
+  if(from < 0 || from >= graph->num_nodes || to < 0 || to >= graph->num_nodes){
+    printf("ERROR: Edge between nodes that are not in the graph\n");
+    return;
+  }
+
+  struct graph_node* node = &graph->nodes[from];
+
+  if(node->num_successors == node->successor_capacity){
+
+    int capacity = (node->successor_capacity > 0) ? node->successor_capacity*2 : 4;
+    int* bigger = realloc(node->successors, capacity*sizeof(int));
+    if(bigger == NULL){
+      printf("ERROR: %s\n", strerror(errno));
+      return;
+    }
+    node->successors = bigger;
+    node->successor_capacity = capacity;
+  }
+
+  node->successors[node->num_successors] = to;
+  node->num_successors++;
+  graph->nodes[to].in_degree++;
+
+  graph->verified = 0;
+  return;
+}
+
+/*
+  Returns 1 if every node of the graph can run, that is if the edges 
+contain no cycle, and 0 otherwise. Nodes are removed in the order 
+they could run and a cycle is left over at the end.
+*/
+static int task_graph_acyclic(struct task_graph* graph){
+
+  int* degree = malloc(graph->num_nodes*sizeof(int));
+  int* ready = malloc(graph->num_nodes*sizeof(int));
+  int num_ready = 0;
+  int removed = 0;
+
+  if(degree == NULL || ready == NULL){
+    printf("ERROR: %s\n", strerror(errno));
+    free(degree);
+    free(ready);
+    return 0;
+  }
+
+  for(int i=0; i<graph->num_nodes; i++){
+    degree[i] = graph->nodes[i].in_degree;
+    if(degree[i] == 0){
+      ready[num_ready++] = i;
+    }
+  }
+
+  while(num_ready > 0){
+
+    struct graph_node* node = &graph->nodes[ready[--num_ready]];
+    removed++;
+
+    for(int i=0; i<node->num_successors; i++){
+      if(--degree[node->successors[i]] == 0){
+	ready[num_ready++] = node->successors[i];
+      }
+    }
+  }
+
+  free(degree);
+  free(ready);
+  return removed == graph->num_nodes;
+}
+
+/*
+  Starts running the graph and returns without waiting. The graph 
+must not be changed or submitted again until task_graph_wait returns.
+*/
+void task_graph_submit(struct task_graph* graph){
+
+  if(atomic_load(&graph->group.pending) != 0){
+    printf("ERROR: Task graph is still running\n");
+    return;
+  }
+
+  if(!graph->verified){
+    if(!task_graph_acyclic(graph)){
+      printf("ERROR: Task graph contains a cycle\n");
+      return;
+    }
+    graph->verified = 1;
+  }
+
+  if(graph->num_nodes == 0){
+    return;
+  }
+
+  for(int i=0; i<graph->num_nodes; i++){
+    atomic_store_explicit(&graph->nodes[i].pending, graph->nodes[i].in_degree, memory_order_relaxed);
+  }
+
+  //every node is counted up front so the count can only reach 0 once
+  //the last node has finished
+  atomic_fetch_add(&graph->group.pending, graph->num_nodes);
+
+  struct graph_node* ready[GRAPH_BATCH];
+  int num_ready = 0;
+
+  for(int i=0; i<graph->num_nodes; i++){
+    if(graph->nodes[i].in_degree == 0){
+      ready[num_ready++] = &graph->nodes[i];
+      if(num_ready == GRAPH_BATCH){
+	submit_graph_nodes(graph, ready, num_ready);
+	num_ready = 0;
+      }
+    }
+  }
+  submit_graph_nodes(graph, ready, num_ready);
+  return;
+}
+
+/*
+  Adds a task for each of the 'n' nodes in one batch. A node that no 
+task can be allocated for is run by the calling thread.
+*/
+static void submit_graph_nodes(struct task_graph* graph, struct graph_node* nodes[], int n){
+
+  struct task* tasks[GRAPH_BATCH];
+  int added = 0;
+
+  for(int i=0; i<n; i++){
+
+    struct task* new_task = alloc_task(graph->pool);
+    if(new_task == NULL){
+      graph_node_done(nodes[i], 1);
+      continue;
+    }
+
+    new_task->function = nodes[i]->function;
+    new_task->arg = nodes[i]->arg;
+    new_task->priority = 0;
+    new_task->group = &graph->group;
+    new_task->node = nodes[i];
+    tasks[added++] = new_task;
+  }
+
+  if(added > 0){
+    submit_tasks(graph->pool, tasks, added);
+  }
+  return;
+}
+
+/*
+  Called once 'node' has run, or to run it if 'run_first' is set. Marks
+its successors as having one less unfinished predecessor. The first
+successor to become ready is run right here and the others are added 
+as tasks. Nodes run here are counted off the graph's group here; the
+node of a task is counted off by run_task.
+*/
+static void graph_node_done(struct graph_node* node, int run_first){
+
+  struct task_graph* graph = node->graph;
+  struct graph_node* ready[GRAPH_BATCH];
+  struct graph_node* next;
+  int num_ready;
+  int counted = 0;
+
+  if(run_first){
+    node->function(node->arg);
+    counted = 1;
+  }
+
+  while(node != NULL){
+
+    next = NULL;
+    num_ready = 0;
+
+    for(int i=0; i<node->num_successors; i++){
+
+      struct graph_node* successor = &graph->nodes[node->successors[i]];
+      if(atomic_fetch_sub_explicit(&successor->pending, 1, memory_order_acq_rel) != 1){
+	continue;
+      }
+
+      if(next == NULL){
+	next = successor;
+      }
+      else{
+	ready[num_ready++] = successor;
+	if(num_ready == GRAPH_BATCH){
+	  submit_graph_nodes(graph, ready, num_ready);
+	  num_ready = 0;
+	}
+      }
+    }
+    submit_graph_nodes(graph, ready, num_ready);
+
+    if(counted){
+      task_group_done(&graph->group);
+    }
+
+    node = next;
+    if(node != NULL){
+      node->function(node->arg);
+      counted = 1;
+    }
+  }
+  return;
+}
+
+/*
+  Blocks until every node of the graph has run. Like task_group_wait a
+thread of the pool runs queued tasks while it waits.
+*/
+void task_graph_wait(struct task_graph* graph){
+
+  task_group_wait(&graph->group);
+  return;
+}
+
+//Frees a graph that is not running
+void destroy_task_graph(struct task_graph* graph){
+
+  for(int i=0; i<graph->num_nodes; i++){
+    free(graph->nodes[i].successors);
+  }
+  free(graph->nodes);
+  free(graph);
+  return;
+}
+
+//=====================Parallel Loop Functions=====================
+
+/*
+  pool_parallel_for runs 'body' over [begin, end) in chunks of at most
+'grain' iterations. Rather than adding a task per chunk, the threads 
+taking part claim chunks from a shared counter, so a loop adds at most
+one task per thread of the pool, all under a single lock. The calling
+thread takes part as well, so the loop finishes even if every thread of
+the pool is busy. Blocks until every iteration has run.
+*/
+void pool_parallel_for(struct thread_pool* pool, long begin, long end, long grain, void (*body)(long begin, long end, void* ctx), void* ctx){
+
+  if(pool == NULL){
+    printf("ERROR: First parameter is not a valid thread_pool\n");
+    return;
+  }
+
+  struct parallel_job setup;
+  setup.body = body;
+  setup.reduce_body = NULL;
+  setup.combine = NULL;
+  setup.ctx = ctx;
+  setup.size = 0;
+
+  parallel_loop(pool, begin, end, grain, &setup, NULL);
+  return;
+}
+
+/*
+  Same as pool_parallel_for except every thread taking part gets its
+own partial result of 'size' bytes. On entry 'result' holds the 
+identity value, which every partial starts as a copy of. body adds the
+iterations [b, e) into the partial it is given. Once the loop is done 
+the partials are combined pairwise in a tree and the total is combined
+into 'result'.
+*/
+void pool_parallel_reduce(struct thread_pool* pool, long begin, long end, long grain, void* result, size_t size, void (*body)(long begin, long end, void* partial, void* ctx), void (*combine)(void* into, const void* from, void* ctx), void* ctx){
+
+  if(pool == NULL){
+    printf("ERROR: First parameter is not a valid thread_pool\n");
+    return;
+  }
+
+  struct parallel_job setup;
+  setup.body = NULL;
+  setup.reduce_body = body;
+  setup.combine = combine;
+  setup.ctx = ctx;
+  setup.size = size;
+
+  parallel_loop(pool, begin, end, grain, &setup, result);
+  return;
+}
+
+/*
+  Same as pool_parallel_reduce except the loop body is built from 'map',
+which writes the value of iteration i, and 'combine', which adds that
+value into the partial result.
+*/
+void pool_map_reduce(struct thread_pool* pool, long begin, long end, long grain, void* result, size_t size, void (*map)(long i, void* value, void* ctx), void (*combine)(void* into, const void* from, void* ctx), void* ctx){
+
+  struct map_reduce_info info;
+  info.map = map;
+  info.combine = combine;
+  info.ctx = ctx;
+  info.size = size;
+
+  pool_parallel_reduce(pool, begin, end, grain, result, size, map_reduce_body, map_reduce_combine, &info);
+  return;
+}
+
+//The loop body of pool_map_reduce
+static void map_reduce_body(long begin, long end, void* partial, void* ctx){
+
+  struct map_reduce_info* info = (struct map_reduce_info*)ctx;
+  _Alignas(16) char value[info->size];
+
+  for(long i=begin; i<end; i++){
+    info->map(i, value, info->ctx);
+    info->combine(partial, value, info->ctx);
+  }
+  return;
+}
+
+static void map_reduce_combine(void* into, const void* from, void* ctx){
+
+  struct map_reduce_info* info = (struct map_reduce_info*)ctx;
+  info->combine(into, from, info->ctx);
+  return;
+}
+
+/*
+  Runs the loop described by 'setup'. If 'setup' has a reduce_body
+'result' holds the identity on entry and the combined total on return.
+When there is no one to help, or the job cannot be allocated, the 
+calling thread runs the whole loop into 'result' itself.
+*/
+static void parallel_loop(struct thread_pool* pool, long begin, long end, long grain, struct parallel_job* setup, void* result){
+
+  char* identity = NULL;
+
+  if(begin >= end){
+    return;
+  }
+
+  //the timed iterations are added straight into 'result' so a copy of
+  //the identity is kept for the partials
+  if(setup->reduce_body != NULL){
+    identity = malloc(setup->size);
+    if(identity == NULL){
+      printf("ERROR: %s\n", strerror(errno));
+      return;
+    }
+    memcpy(identity, result, setup->size);
+  }
+
+  if(grain <= 0){
+    grain = parallel_grain(pool, &begin, end, setup, result);
+  }
+
+  long chunks = (begin < end) ? (end-begin)/grain + ((end-begin)%grain != 0) : 0;
+  int helpers = parallel_helpers(pool, chunks);
+  size_t stride = (setup->size+63)/64*64;
+  struct parallel_job* job = NULL;
+
+  if(helpers > 0){
+    job = aligned_alloc(64, sizeof(struct parallel_job));
+  }
+  if(job != NULL){
+    job->slots = NULL;
+    if(identity != NULL){
+      job->slots = aligned_alloc(64, stride*(helpers+1));
+      if(job->slots == NULL){
+	free(job);
+	job = NULL;
+      }
+    }
+  }
+
+  //run the loop on the calling thread
+  if(job == NULL){
+    for(long b=begin; b<end; b=b+grain){
+      parallel_chunk(setup, b, (end-b > grain) ? b+grain : end, result);
+    }
+    free(identity);
+    return;
+  }
+
+  job->body = setup->body;
+  job->reduce_body = setup->reduce_body;
+  job->combine = setup->combine;
+  job->ctx = setup->ctx;
+  job->size = setup->size;
+  job->stride = stride;
+  job->end = end;
+  job->grain = grain;
+  atomic_init(&job->references, helpers+1);
+  atomic_init(&job->state, 0);
+  atomic_init(&job->next_slot, 0);
+  atomic_init(&job->next, begin);
+  atomic_init(&job->remaining, end-begin);
+
+  for(int i=0; i<=helpers && identity != NULL; i++){
+    memcpy(job->slots + i*stride, identity, setup->size);
+  }
+
+  int added = submit_internal_tasks(pool, parallel_helper, job, helpers);
+  if(added < helpers){
+    atomic_fetch_sub(&job->references, helpers-added);
+  }
+
+  parallel_run(job);
+  future_wait(&job->state);
+
+  if(identity != NULL){
+
+    //slots that were never claimed still hold the identity
+    int used = atomic_load(&job->next_slot);
+    if(used > helpers+1){
+      used = helpers+1;
+    }
+
+    for(int step=1; step<used; step=step*2){
+      for(int i=0; i+step<used; i=i+2*step){
+	job->combine(job->slots + i*stride, job->slots + (i+step)*stride, job->ctx);
+      }
+    }
+    job->combine(result, job->slots, job->ctx);
+    free(identity);
+  }
+
+  parallel_job_release(job);
+  return;
+}
+
+//Runs the iterations [begin, end) of the loop, into 'partial' if it reduces
+static void parallel_chunk(struct parallel_job* job, long begin, long end, void* partial){
+
+  if(job->reduce_body != NULL){
+    job->reduce_body(begin, end, partial, job->ctx);
+  }
+  else{
+    job->body(begin, end, job->ctx);
+  }
+  return;
+}
+
+/*
+  Finds a grain for a parallel loop by timing the body on the first 
+iterations of the loop. The iterations it times are done, so 'begin'
+is moved past them.
+*/
+static long parallel_grain(struct thread_pool* pool, long* begin, long end, struct parallel_job* setup, void* result){
+
+  struct timespec start;
+  struct timespec now;
+  long elapsed = 0;
+  long measured = 0;
+  long probe = 1;
+  long stop;
+
+  while(*begin < end && elapsed < PARALLEL_PROBE_NS){
+
+    stop = (end-*begin > probe) ? *begin+probe : end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    parallel_chunk(setup, *begin, stop, result);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    elapsed += (now.tv_sec-start.tv_sec)*1000000000L + (now.tv_nsec-start.tv_nsec);
+    measured += stop-*begin;
+    *begin = stop;
+    probe = probe*2;
+  }
+
+  if(elapsed < 1){
+    elapsed = 1;
+  }
+
+  long grain = (long)((double)measured*PARALLEL_CHUNK_NS/elapsed);
+  long limit = (end-*begin)/((long)(pool->number_threads+1)*PARALLEL_CHUNKS_PER_THREAD);
+
+  if(grain > limit){
+    grain = limit;
+  }
+  if(grain < 1){
+    grain = 1;
+  }
+  return grain;
+}
+
+/*
+  Returns how many helper tasks are worth adding for 'chunks' chunks of
+work: one per thread of the pool other than the caller, but never more
+than there are chunks left after the caller's first.
+*/
+static int parallel_helpers(struct thread_pool* pool, long chunks){
+
+  long helpers = pool->number_threads;
+
+  if(current_worker != NULL && current_worker->pool == pool){
+    helpers--;
+  }
+  if(helpers > chunks-1){
+    helpers = chunks-1;
+  }
+  return (helpers > 0) ? (int)helpers : 0;
+}
+
+/*
+  Adds 'n' internal tasks that all run 'function' with 'arg' in one 
+batch. Returns how many were added, which is fewer than 'n' only if
+tasks could not be allocated.
+*/
+static int submit_internal_tasks(struct thread_pool* pool, void (*function)(void* arg), void* arg, int n){
+
+  struct task** tasks = malloc(n*sizeof(struct task*));
+  if(tasks == NULL){
+    printf("ERROR: %s\n", strerror(errno));
+    return 0;
+  }
+
+  int added = 0;
+  while(added < n){
+
+    tasks[added] = alloc_task(pool);
+    if(tasks[added] == NULL){
+      break;
+    }
+
+    tasks[added]->function = function;
+    tasks[added]->arg = arg;
+    tasks[added]->priority = INT64_MAX;
+    tasks[added]->internal = 1;
+    added++;
+  }
+
+  if(added > 0){
+    submit_tasks(pool, tasks, added);
+  }
+
+  free(tasks);
+  return added;
+}
+
+/*
+  Claims chunks of the loop until none are left. A reducing loop first
+claims a slot of its own to accumulate into, so no two threads ever 
+write the same cache line. The thread that runs the last iterations 
+marks the job done.
+*/
+static void parallel_run(struct parallel_job* job){
+
+  long grain = job->grain;
+  long end = job->end;
+  long done = 0;
+  char* partial = NULL;
+  long b;
+
+  if(job->slots != NULL){
+    partial = job->slots + atomic_fetch_add_explicit(&job->next_slot, 1, memory_order_relaxed)*job->stride;
+  }
+
+  while(1){
+
+    b = atomic_fetch_add_explicit(&job->next, grain, memory_order_relaxed);
+    if(b >= end){
+      break;
+    }
+
+    parallel_chunk(job, b, (end-b > grain) ? b+grain : end, partial);
+    done += (end-b > grain) ? grain : end-b;
+  }
+
+  if(done > 0 && atomic_fetch_sub_explicit(&job->remaining, done, memory_order_acq_rel) == done){
+    if(atomic_fetch_or_explicit(&job->state, FUTURE_DONE, memory_order_release)&FUTURE_WAITERS){
+      future_wake(&job->state);
+    }
+  }
+  return;
+}
+
+//The function of the tasks a parallel loop adds
+static void parallel_helper(void* arg){
+
+  parallel_run((struct parallel_job*)arg);
+  parallel_job_release((struct parallel_job*)arg);
+  return;
+}
+
+static void parallel_job_release(struct parallel_job* job){
+
+  if(atomic_fetch_sub_explicit(&job->references, 1, memory_order_acq_rel) == 1){
+    free(job->slots);
+    free(job);
+  }
+  return;
+}
+
+//==========================NUMA Functions==========================
+
+
+/*
+  Pins the threads of the pool to the 'n' CPUs in 'cpus', each thread 
+to one CPU in turn. Threads already running are moved and threads 
+added later are pinned as they are created. Passing n = 0 stops 
+pinning new threads.
+*/
+void pool_set_affinity(struct thread_pool* pool, const int* cpus, int n){
+
+  if(pool == NULL){
+    printf("ERROR: Parameter is not a valid thread_pool\n");
+    return;
+  }
+
+#ifdef __linux__
+  for(int i=0; i<n; i++){
+    if(cpus[i] < 0 || cpus[i] >= CPU_SETSIZE){
+      printf("ERROR: %d is not a valid CPU\n", cpus[i]);
+      return;
+    }
+  }
+
+  int* copy = NULL;
+  if(n > 0){
+    copy = malloc(n*sizeof(int));
+    if(copy == NULL){
+      printf("ERROR: %s\n", strerror(errno));
+      return;
+    }
+    memcpy(copy, cpus, n*sizeof(int));
+  }
+
+  pthread_mutex_lock(&pool->modify_pool);
+
+  free(pool->cpus);
+  pool->cpus = copy;
+  pool->num_cpus = (n > 0) ? n : 0;
+  pool->pin_each = 1;
+  pool->next_cpu = 0;
+
+  for(struct thread_info* step_through = pool->thread_list; step_through != NULL; step_through = step_through->next){
+    pin_thread(pool, step_through->thread, pool->next_cpu);
+    pool->next_cpu++;
+  }
+
+  pthread_mutex_unlock(&pool->modify_pool);
+#else
+  printf("ERROR: CPU affinity is not supported on this system\n");
+#endif
+  return;
+}
+
+/*
+  Pins 'thread' to CPU cpus[slot % num_cpus] of the pool, or to all of
+the pool's CPUs if pin_each is 0. Does nothing if the pool has no CPUs
+set. The caller holds modify_pool.
+*/
+static void pin_thread(struct thread_pool* pool, pthread_t thread, int slot){
+
+#ifdef __linux__
+  if(pool->num_cpus == 0){
+    return;
+  }
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+
+  if(pool->pin_each){
+    CPU_SET(pool->cpus[slot%pool->num_cpus], &set);
+  }
+  else{
+    for(int i=0; i<pool->num_cpus; i++){
+      CPU_SET(pool->cpus[i], &set);
+    }
+  }
+
+  int error = pthread_setaffinity_np(thread, sizeof(cpu_set_t), &set);
+  if(error != 0){
+    printf("ERROR: %s\n", strerror(error));
+  }
+#endif
+  return;
+}
+
+/*
+  Creates one pool for each NUMA node that has CPUs, with 
+'threads_per_node' threads, or one per CPU of the node if it is 0. 
+Each pool's threads are pinned to the CPUs of its node, so the tasks
+they add and the memory the tasks come from stay on the node. If the
+nodes cannot be found there is a single node holding every CPU.
+*/
+struct numa_pool* create_numa_pool(int threads_per_node, int mode, int (*function)(const void* p1, const void* p2)){
+
+  if(threads_per_node < 0){
+    printf("ERROR: Cannot add %d threads to thread pool\n", threads_per_node);
+    return NULL;
+  }
+
+  struct numa_pool* numa = malloc(sizeof(struct numa_pool));
+  int* cpus = malloc(NUMA_MAX_CPUS*sizeof(int));
+  int node_ids[NUMA_MAX_NODES];
+  int ranks[NUMA_MAX_NODES];
+  int online = 0;
+
+  if(numa == NULL || cpus == NULL){
+    printf("ERROR: %s\n", strerror(errno));
+    free(numa);
+    free(cpus);
+    return NULL;
+  }
+
+  numa->nodes = malloc(NUMA_MAX_NODES*sizeof(struct thread_pool*));
+  numa->num_nodes = 0;
+  atomic_init(&numa->next_node, 0);
+
+  if(numa->nodes == NULL){
+    printf("ERROR: %s\n", strerror(errno));
+    free(numa);
+    free(cpus);
+    return NULL;
+  }
+
+  //the pools start without threads so they can be linked first
+  for(int id=0; id<NUMA_MAX_NODES; id++){
+
+    char path[256];
+    snprintf(path, sizeof(path), "%s/node%d/cpulist", NUMA_SYSFS, id);
+
+    int n = read_cpu_list(path, cpus, NUMA_MAX_CPUS);
+    if(n < 0){
+      continue;
+    }
+
+    //nodes with memory but no CPUs still have a column in 'distance'
+    online++;
+    if(n == 0){
+      continue;
+    }
+
+    struct thread_pool* pool = create_pool(0, mode, function);
+    if(pool == NULL){
+      continue;
+    }
+
+    pool->cpus = malloc(n*sizeof(int));
+    if(pool->cpus != NULL){
+      memcpy(pool->cpus, cpus, n*sizeof(int));
+      pool->num_cpus = n;
+    }
+    pool->pin_each = 0;
+    pool->numa = numa;
+    pool->node = numa->num_nodes;
+
+    node_ids[numa->num_nodes] = id;
+    ranks[numa->num_nodes] = online-1;
+    numa->nodes[numa->num_nodes] = pool;
+    numa->num_nodes++;
+  }
+
+  free(cpus);
+
+  if(numa->num_nodes == 0){
+
+    struct thread_pool* pool = create_pool(0, mode, function);
+    if(pool == NULL){
+      free(numa->nodes);
+      free(numa);
+      return NULL;
+    }
+    pool->numa = numa;
+    numa->nodes[0] = pool;
+    numa->num_nodes = 1;
+  }
+
+  if(numa->num_nodes > 1){
+    link_numa_nodes(numa, node_ids, ranks);
+  }
+
+  for(int k=0; k<numa->num_nodes; k++){
+
+    struct thread_pool* pool = numa->nodes[k];
+    int number_threads = threads_per_node;
+
+    if(number_threads == 0){
+      number_threads = (pool->num_cpus > 0) ? pool->num_cpus : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    add_threads(number_threads > 0 ? number_threads : 1, pool);
+  }
+
+  return numa;
+}
+
+/*
+  Reads a list of CPUs such as "0-3,8,10-11" from the file at 'path' 
+into 'cpus', keeping at most 'max' of them. Returns how many were 
+read, or -1 if the file could not be opened.
+*/
+static int read_cpu_list(const char* path, int* cpus, int max){
+
+  FILE* file = fopen(path, "r");
+  char line[4096];
+  int n = 0;
+
+  if(file == NULL){
+    return -1;
+  }
+
+  if(fgets(line, sizeof(line), file) == NULL){
+    fclose(file);
+    return 0;
+  }
+  fclose(file);
+
+  char* step_through = line;
+  char* end;
+
+  while(1){
+
+    long first = strtol(step_through, &end, 10);
+    if(end == step_through){
+      break;
+    }
+
+    long last = first;
+    step_through = end;
+    if(*step_through == '-'){
+      last = strtol(step_through+1, &end, 10);
+      step_through = end;
+    }
+
+    for(long cpu=first; cpu<=last && cpu<max && n<max; cpu++){
+      if(cpu >= 0){
+	cpus[n] = (int)cpu;
+	n++;
+      }
+    }
+
+    if(*step_through != ','){
+      break;
+    }
+    step_through++;
+  }
+
+  return n;
+}
+
+/*
+  Reads the distances from node 'node' to every online node, in order
+of node number, into 'distances'. Returns how many were read.
+*/
+static int read_node_distances(int node, int* distances, int max){
+
+  char path[256];
+  snprintf(path, sizeof(path), "%s/node%d/distance", NUMA_SYSFS, node);
+
+  FILE* file = fopen(path, "r");
+  int n = 0;
+
+  if(file == NULL){
+    return 0;
+  }
+
+  while(n < max && fscanf(file, "%d", &distances[n]) == 1){
+    n++;
+  }
+
+  fclose(file);
+  return n;
+}
+
+/*
+  Gives every pool of 'numa' the list of the other pools, nearest first
+by the node distances the kernel reports. node_ids[k] is the node 
+number of pool k and ranks[k] its position among the online nodes.
+*/
+static void link_numa_nodes(struct numa_pool* numa, int* node_ids, int* ranks){
+
+  int distances[NUMA_MAX_NODES];
+  int order[NUMA_MAX_NODES];
+
+  for(int k=0; k<numa->num_nodes; k++){
+
+    struct thread_pool* pool = numa->nodes[k];
+    int n = read_node_distances(node_ids[k], distances, NUMA_MAX_NODES);
+    int count = 0;
+
+    pool->neighbours = malloc((numa->num_nodes-1)*sizeof(struct thread_pool*));
+    if(pool->neighbours == NULL){
+      printf("ERROR: %s\n", strerror(errno));
+      continue;
+    }
+
+    //insertion sort of the other pools by distance
+    for(int j=0; j<numa->num_nodes; j++){
+
+      if(j == k){
+	continue;
+      }
+
+      int distance = (ranks[j] < n) ? distances[ranks[j]] : INT_MAX;
+      int i = count;
+      while(i > 0 && ((ranks[order[i-1]] < n) ? distances[ranks[order[i-1]]] : INT_MAX) > distance){
+	order[i] = order[i-1];
+	i--;
+      }
+      order[i] = j;
+      count++;
+    }
+
+    for(int i=0; i<count; i++){
+      pool->neighbours[i] = numa->nodes[order[i]];
+    }
+    pool->num_neighbours = count;
+  }
+  return;
+}
+
+//Returns the number of nodes, and so of pools, in 'numa'
+int numa_pool_nodes(struct numa_pool* numa){
+
+  if(numa == NULL){
+    printf("ERROR: Parameter is not a valid numa_pool\n");
+    return 0;
+  }
+  return numa->num_nodes;
+}
+
+/*
+  Returns the pool of node 'node' so that the rest of the thread pool
+functions can be used on it.
+*/
+struct thread_pool* numa_pool_node(struct numa_pool* numa, int node){
+
+  if(numa == NULL){
+    printf("ERROR: Parameter is not a valid numa_pool\n");
+    return NULL;
+  }
+
+  if(node < 0 || node >= numa->num_nodes){
+    printf("ERROR: %d is not a node of the numa_pool\n", node);
+    return NULL;
+  }
+  return numa->nodes[node];
+}
+
+/*
+  Adds a task to the pool of node 'node'. A negative node means no 
+preference: a thread of the numa_pool adds it to its own node and any
+other thread spreads its tasks over the nodes in turn.
+*/
+void add_task_on_node(struct numa_pool* numa, int node, void (*function)(void* arg), void* arg){
+
+  if(numa == NULL){
+    printf("ERROR: First parameter is not a valid numa_pool\n");
+    return;
+  }
+
+  if(node >= numa->num_nodes){
+    printf("ERROR: %d is not a node of the numa_pool\n", node);
+    return;
+  }
+
+  if(node < 0){
+    if(current_worker != NULL && current_worker->pool->numa == numa){
+      node = current_worker->pool->node;
+    }
+    else{
+      node = atomic_fetch_add_explicit(&numa->next_node, 1, memory_order_relaxed)%numa->num_nodes;
+    }
+  }
+
+  add_task(numa->nodes[node], function, arg);
+  return;
+}
+
+/*
+  Looks for a task in the pools of the other NUMA nodes, nearest first,
+once the calling thread's own pool has run out. '*owner' is set to the
+pool the task came from. Nothing is taken once the caller's pool is 
+closing.
+*/
+static struct task* steal_remote_task(struct thread_info* self, struct thread_pool** owner){
+
+  struct thread_pool* pool = self->pool;
+  struct thread_pool* victim;
+  struct task* to_do;
+
+  if(pool->kill_immediately == 1 || pool->kill_when_idle == 1){
+    return NULL;
+  }
+
+  for(int i=0; i<pool->num_neighbours; i++){
+
+    victim = pool->neighbours[i];
+    to_do = NULL;
+
+    if(victim->kill_immediately == 1){
+      continue;
+    }
+
+    //the caller has no deque in the victim's pool so it only steals
+    if(victim->pull == ws_FIFO_pull_task || victim->pull == ws_LIFO_pull_task){
+      to_do = ws_steal_task(victim, self);
+    }
+    else if(victim->lock_free){
+      to_do = victim->pull(victim);
+    }
+    else if(atomic_load_explicit(&victim->num_tasks_in_queue, memory_order_relaxed) > 0){
+      pthread_mutex_lock(&victim->modify_pool);
+      to_do = pull_task(victim);
+      pthread_mutex_unlock(&victim->modify_pool);
+    }
+
+    if(to_do != NULL){
+      (*owner) = victim;
+      return to_do;
+    }
+  }
+
+  return NULL;
+}
+
+/*
+  Wakes one idle thread of the nearest node that has one, after a task
+was added to 'pool' and none of its own threads were idle to take it.
+The woken thread finds nothing in its own queue and goes on to 
+steal_remote_task, so a burst added to one node is shared with the 
+others instead of waiting for its threads. Called without holding 
+pool's modify_pool.
+*/
+static void wake_neighbour(struct thread_pool* pool){
+
+  struct thread_pool* other;
+
+  for(int i=0; i<pool->num_neighbours; i++){
+
+    other = pool->neighbours[i];
+    if(atomic_load_explicit(&other->num_idle_threads, memory_order_relaxed) == 0){
+      continue;
+    }
+
+    pthread_mutex_lock(&other->modify_pool);
+    if(other->idle_stack != NULL){
+      wake_threads(other, 1);
+      pthread_mutex_unlock(&other->modify_pool);
+      return;
+    }
+    pthread_mutex_unlock(&other->modify_pool);
+  }
+  return;
+}
+
+/*
+  Waits until the pools of every node are idle at the same time, since
+a task on one node may add tasks to another, and then destroys them.
+*/
+void destroy_numa_pool_when_idle(struct numa_pool* numa){
+
+  if(numa == NULL){
+    printf("ERROR: Parameter is not a valid numa_pool\n");
+    return;
+  }
+
+  int idle = 0;
+  while(!idle){
+    idle = 1;
+    for(int k=0; k<numa->num_nodes; k++){
+      if(pool_pending(numa->nodes[k]) != 0){
+	pool_wait_idle(numa->nodes[k]);
+	idle = 0;
+      }
+    }
+  }
+
+  //threads may steal from any pool so none is freed until all are 
+  //joined
+  for(int k=0; k<numa->num_nodes; k++){
+    close_when_idle(numa->nodes[k]);
+  }
+  for(int k=0; k<numa->num_nodes; k++){
+    join_threads(numa->nodes[k]);
+  }
+  for(int k=0; k<numa->num_nodes; k++){
+    free_pool(numa->nodes[k]);
+  }
+
+  free(numa->nodes);
+  free(numa);
+  return;
+}
+
+//Same as destroy_pool_immediately for the pools of every node
+void destroy_numa_pool_immediately(struct numa_pool* numa){
+
+  if(numa == NULL){
+    printf("ERROR: Parameter is not a valid numa_pool\n");
+    return;
+  }
+
+  for(int k=0; k<numa->num_nodes; k++){
+    close_immediately(numa->nodes[k]);
+  }
+  for(int k=0; k<numa->num_nodes; k++){
+    join_threads(numa->nodes[k]);
+  }
+  for(int k=0; k<numa->num_nodes; k++){
+    free_pool(numa->nodes[k]);
+  }
+
+  free(numa->nodes);
+  free(numa);
+  return;
+}
+
+//=======================Latency Functions=========================
+
+/*
+  Starts recording how long tasks wait in the queue and how long they
+run. 'bounds' holds n ascending priorities that split the tasks into 
+n+1 classes, each with its own histograms. A task belongs to the first
+class whose bound is greater than its priority. A negative n stops the
+recording.
+*/
+void pool_set_latency_classes(struct thread_pool* pool, const int64_t* bounds, int n){
+
+  if(pool == NULL){
+    printf("ERROR: Parameter is not a valid thread_pool\n");
+    return;
+  }
+
+  if(n >= LATENCY_CLASSES || (n > 0 && bounds == NULL)){
+    printf("ERROR: At most %d priority bounds can be given\n", LATENCY_CLASSES-1);
+    return;
+  }
+
+  for(int i=1; i<n; i++){
+    if(bounds[i] <= bounds[i-1]){
+      printf("ERROR: Priority bounds must be in ascending order\n");
+      return;
+    }
+  }
+
+#ifndef THREAD_POOL_NO_STATS
+  if(n < 0){
+    atomic_store(&pool->latency_classes, 0);
+    return;
+  }
+
+  //stop recording while the bounds change
+  atomic_store(&pool->latency_classes, 0);
+  for(int i=0; i<n; i++){
+    pool->latency_bounds[i] = bounds[i];
+  }
+  atomic_store(&pool->latency_classes, n+1);
+#endif
+  return;
+}
+
+//Marks the time the tasks were added if the pool records latency
+static void latency_stamp(struct thread_pool* pool, struct task* tasks[], int n){
+
+#ifndef THREAD_POOL_NO_STATS
+  if(atomic_load_explicit(&pool->latency_classes, memory_order_relaxed) == 0){
+    return;
+  }
+
+  unsigned long now = stat_clock();
+  for(int i=0; i<n; i++){
+    tasks[i]->enqueued = now;
+  }
+#else
+  (void)pool;
+  (void)tasks;
+  (void)n;
+#endif
+  return;
+}
+
+/*
+  Adds a task that started running at 'start' and finished at 'end' to 
+the histograms of the calling thread, which are allocated the first 
+time it records. Only that thread writes them.
+*/
+static void record_latency(struct thread_pool* pool, struct task* to_do, unsigned long start, unsigned long end){
+
+#ifndef THREAD_POOL_NO_STATS
+  struct task_cache* cache = get_task_cache(pool);
+  if(cache == NULL){
+    return;
+  }
+
+  struct latency_histograms* histograms = atomic_load_explicit(&cache->latency, memory_order_relaxed);
+  if(histograms == NULL){
+
+    histograms = calloc(1, sizeof(struct latency_histograms));
+    if(histograms == NULL){
       printf("ERROR: %s\n", strerror(errno));
-    }     
-    
-    temp = step_through;
-    step_through = step_through->next;
-    free(temp);
-  }    
+      return;
+    }
+    atomic_store_explicit(&cache->latency, histograms, memory_order_release);
+  }
 
-  free(pool);
-  pool = NULL;
+  int classes = atomic_load_explicit(&pool->latency_classes, memory_order_relaxed);
+  int c = 0;
+  while(c < classes-1 && to_do->priority >= pool->latency_bounds[c]){
+    c++;
+  }
+
+  //tasks added before the recording started have no time
+  if(to_do->enqueued != 0 && start >= to_do->enqueued){
+    STAT_ADD(histograms, wait[c][latency_bucket(start - to_do->enqueued)], 1);
+  }
+  STAT_ADD(histograms, run[c][latency_bucket(end - start)], 1);
+#else
+  (void)pool;
+  (void)to_do;
+  (void)start;
+  (void)end;
+#endif
+  return;
+}
+
+#ifndef THREAD_POOL_NO_STATS
+//Returns the histogram bucket a time of 'ns' nanoseconds falls into
+static int latency_bucket(unsigned long ns){
+
+  if(ns < LATENCY_SUB_BUCKETS){
+    return ns;
+  }
+
+  //the power of two and the next three bits below it
+  int power = 63 - __builtin_clzl(ns);
+  int bucket = (power-2)*LATENCY_SUB_BUCKETS + ((ns >> (power-3)) & (LATENCY_SUB_BUCKETS-1));
+
+  return (bucket < LATENCY_BUCKETS) ? bucket : LATENCY_BUCKETS-1;
+}
+
+//Returns the largest time that falls into a bucket
+static unsigned long latency_value(int bucket){
+
+  if(bucket < LATENCY_SUB_BUCKETS){
+    return bucket;
+  }
+
+  int power = bucket/LATENCY_SUB_BUCKETS + 2;
+  unsigned long sub = bucket%LATENCY_SUB_BUCKETS;
+
+  return ((LATENCY_SUB_BUCKETS+sub+1) << (power-3)) - 1;
+}
+#endif
+
+/*
+  Merges the histograms of every thread for one interval, 0 for the 
+time in the queue and 1 for the time running, and one priority class,
+or all of them if 'priority_class' is negative. The counts are read 
+while the threads keep adding to them, so a snapshot may miss the 
+tasks finishing at that moment.
+*/
+void pool_get_latency(struct thread_pool* pool, int interval, int priority_class, struct pool_latency* result){
+
+  if(pool == NULL){
+    printf("ERROR: Parameter is not a valid thread_pool\n");
+    return;
+  }
+
+  if(interval != 0 && interval != 1){
+    printf("ERROR: %d is not a valid interval\n", interval);
+    return;
+  }
+
+  if(priority_class >= LATENCY_CLASSES){
+    printf("ERROR: %d is not a valid priority class\n", priority_class);
+    return;
+  }
+
+  memset(result, 0, sizeof(struct pool_latency));
+
+#ifndef THREAD_POOL_NO_STATS
+  unsigned long counts[LATENCY_BUCKETS] = {0};
+  int first = (priority_class < 0) ? 0 : priority_class;
+  int last = (priority_class < 0) ? LATENCY_CLASSES-1 : priority_class;
+
+  pthread_mutex_lock(&pool->modify_caches);
+  for(struct task_cache* cache = pool->caches; cache != NULL; cache = cache->next){
+
+    struct latency_histograms* histograms = atomic_load_explicit(&cache->latency, memory_order_acquire);
+    if(histograms == NULL){
+      continue;
+    }
+
+    for(int c=first; c<=last; c++){
+      atomic_ulong* buckets = (interval == 0) ? histograms->wait[c] : histograms->run[c];
+      for(int b=0; b<LATENCY_BUCKETS; b++){
+	counts[b] += atomic_load_explicit(&buckets[b], memory_order_relaxed);
+      }
+    }
+  }
+  pthread_mutex_unlock(&pool->modify_caches);
+
+  for(int b=0; b<LATENCY_BUCKETS; b++){
+    result->count += counts[b];
+  }
+  if(result->count == 0){
+    return;
+  }
+
+  //the rank of each percentile, rounded up
+  unsigned long p50 = (result->count*500 + 999)/1000;
+  unsigned long p90 = (result->count*900 + 999)/1000;
+  unsigned long p99 = (result->count*990 + 999)/1000;
+  unsigned long p999 = (result->count*999 + 999)/1000;
+  unsigned long seen = 0;
+
+  for(int b=0; b<LATENCY_BUCKETS; b++){
+
+    if(counts[b] == 0){
+      continue;
+    }
+
+    unsigned long before = seen;
+    seen += counts[b];
+
+    if(before < p50 && seen >= p50){
+      result->p50 = latency_value(b);
+    }
+    if(before < p90 && seen >= p90){
+      result->p90 = latency_value(b);
+    }
+    if(before < p99 && seen >= p99){
+      result->p99 = latency_value(b);
+    }
+    if(before < p999 && seen >= p999){
+      result->p999 = latency_value(b);
+    }
+    result->max = latency_value(b);
+  }
+#endif
+  return;
+}
+
+//====================Task Allocator Functions=====================
+
+/*
+  Tasks are never returned to malloc while the pool exists. Each thread
+  that adds tasks to a pool gets its own task_cache of free tasks, 
+  carved out of slabs that double in size from TASK_SLAB_MIN up to
+  TASK_SLAB_MAX tasks. A task remembers the cache it came from and is
+  always returned there. Once the caches have grown to cover the
+  number of tasks in flight, adding and running tasks does no
+  allocation at all.
+*/
+
+/*
+  Returns the calling thread's task_cache for 'pool', creating it on
+first use. The last few caches used by the thread are remembered in
+thread local storage so the lookup under modify_caches is rare.
+*/
+struct task_cache* get_task_cache(struct thread_pool* pool){
+
+  for(int i=0; i<TASK_CACHE_SLOTS; i++){
+    if(local_cache_ids[i] == pool->pool_id){
+      return local_caches[i];
+    }
+  }
+
+  pthread_t self = pthread_self();
+  struct task_cache* cache;
+
+  pthread_mutex_lock(&pool->modify_caches);
+
+  //a cache left behind by a thread that left the pool or exited is 
+  //taken over
+  cache = pool->caches;
+  while(cache != NULL && !cache->orphaned && !pthread_equal(cache->owner, self)){
+    cache = cache->next;
+  }
+
+  if(cache != NULL){
+    cache->owner = self;
+    cache->orphaned = 0;
+  }
+  else{
+
+    cache = aligned_alloc(64, sizeof(struct task_cache));
+    if(cache == NULL){
+      printf("ERROR: %s\n", strerror(errno));
+      pthread_mutex_unlock(&pool->modify_caches);
+      return NULL;
+    }
+
+    cache->local_free = NULL;
+    cache->slabs = NULL;
+    cache->next_slab_size = TASK_SLAB_MIN;
+    cache->owner = self;
+    cache->orphaned = 0;
+    cache->pool = pool;
+    atomic_init(&cache->tasks_submitted, 0);
+    atomic_init(&cache->tasks_finished, 0);
+    atomic_init(&cache->remote_free, NULL);
+#ifndef THREAD_POOL_NO_STATS
+    memset(&cache->stats, 0, sizeof(struct thread_stats));
+    atomic_init(&cache->latency, NULL);
+#endif
+
+    cache->next = pool->caches;
+    pool->caches = cache;
+  }
+
+  pthread_mutex_unlock(&pool->modify_caches);
+
+  pthread_setspecific(pool->cache_key, cache);
+
+  local_caches[local_cache_victim] = cache;
+  local_cache_ids[local_cache_victim] = pool->pool_id;
+  local_cache_victim = (local_cache_victim+1)%TASK_CACHE_SLOTS;
+
+  return cache;
+}
+
+/*
+  Called by a thread leaving the pool. Its cache is marked orphaned so
+the next thread to need one takes it over along with its free tasks,
+and tasks still in flight are returned to it as usual. The key is 
+cleared so the cache is not orphaned again when the thread exits, by
+which time another thread may have taken it.
+*/
+static void release_task_cache(struct thread_pool* pool){
+
+  pthread_setspecific(pool->cache_key, NULL);
+
+  for(int i=0; i<TASK_CACHE_SLOTS; i++){
+    if(local_cache_ids[i] == pool->pool_id){
+
+      pthread_mutex_lock(&pool->modify_caches);
+      local_caches[i]->orphaned = 1;
+      pthread_mutex_unlock(&pool->modify_caches);
+
+      local_caches[i] = NULL;
+      local_cache_ids[i] = 0;
+    }
+  }
+  return;
+}
+
+/*
+  Destructor of pool->cache_key, run when any thread that took a cache
+from the pool exits, such as a short-lived thread that only added 
+tasks. The cache is orphaned like that of a thread leaving the pool, 
+so its slabs and the tasks returned to it are used again instead of 
+being stranded until the pool is destroyed. A thread must be done 
+with a pool before the pool is destroyed, which keeps the cache valid
+here.
+*/
+void orphan_task_cache(void* cache){
+
+  struct task_cache* orphan = cache;
+
+  pthread_mutex_lock(&orphan->pool->modify_caches);
+  orphan->orphaned = 1;
+  pthread_mutex_unlock(&orphan->pool->modify_caches);
+  return;
+}
+
+/*
+  Takes a task from the calling thread's cache. When the cache is 
+empty it first reclaims every task other threads have returned to it
+and only allocates a new slab if there were none.
+*/
+struct task* alloc_task(struct thread_pool* pool){
+
+  struct task_cache* cache = get_task_cache(pool);
+  if(cache == NULL){
+    return NULL;
+  }
+
+  if(cache->local_free == NULL){
+    cache->local_free = atomic_exchange_explicit(&cache->remote_free, NULL, memory_order_acquire);
+  }
+
+  if(cache->local_free == NULL){
+
+    int size = cache->next_slab_size;
+    struct task_slab* slab = malloc(sizeof(struct task_slab) + size*sizeof(struct task));
+
+    if(slab == NULL){
+      printf("ERROR: %s\n", strerror(errno));
+      return NULL;
+    }
+
+    slab->size = size;
+    slab->next = cache->slabs;
+    cache->slabs = slab;
+
+    for(int i=0; i<size; i++){
+      slab->tasks[i].cache = cache;
+      slab->tasks[i].pointer1 = (i+1 < size) ? &slab->tasks[i+1] : NULL;
+    }
+    cache->local_free = &slab->tasks[0];
+
+    if(size < TASK_SLAB_MAX){
+      cache->next_slab_size = size*2;
+    }
+
+    atomic_fetch_add_explicit(&pool->slabs_allocated, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&pool->tasks_allocated, size, memory_order_relaxed);
+  }
+
+  struct task* to_return = cache->local_free;
+  cache->local_free = to_return->pointer1;
+  to_return->future_function = NULL;
+  to_return->group = NULL;
+  to_return->node = NULL;
+  atomic_store_explicit(&to_return->children.pending, 0, memory_order_relaxed);
+  to_return->internal = 0;
+  to_return->enqueued = 0;
+  to_return->queued = 0;
+  atomic_store_explicit(&to_return->references, 0, memory_order_relaxed);
+
+  return to_return;
+}
+
+/*
+  Returns a task to the cache it was allocated from. The owner of the
+cache pushes onto its local list. Any other thread pushes onto the 
+cache's remote list with compare and swap. Only the owner ever takes
+from the remote list, and it takes the whole list at once, so the 
+push cannot suffer from ABA.
+*/
+void free_task(struct task* to_free, struct thread_pool* pool){
+
+  struct task_cache* cache = to_free->cache;
+
+  for(int i=0; i<TASK_CACHE_SLOTS; i++){
+    if(local_caches[i] == cache && local_cache_ids[i] == pool->pool_id){
+      to_free->pointer1 = cache->local_free;
+      cache->local_free = to_free;
+      return;
+    }
+  }
+
+  struct task* head = atomic_load_explicit(&cache->remote_free, memory_order_relaxed);
+  do{
+    to_free->pointer1 = head;
+  }while(!atomic_compare_exchange_weak_explicit(&cache->remote_free, &head, to_free, memory_order_release, memory_order_relaxed));
+
+  return;
+}
+
+//Frees every slab and cache of the pool. Only called on destruction
+void free_task_caches(struct thread_pool* pool){
+
+  struct task_cache* cache = pool->caches;
+  struct task_cache* next_cache;
+  struct task_slab* slab;
+  struct task_slab* next_slab;
+
+  while(cache != NULL){
+
+    slab = cache->slabs;
+    while(slab != NULL){
+      next_slab = slab->next;
+      free(slab);
+      slab = next_slab;
+    }
+
+#ifndef THREAD_POOL_NO_STATS
+    free(atomic_load(&cache->latency));
+#endif
+    next_cache = cache->next;
+    free(cache);
+    cache = next_cache;
+  }
+
+  pool->caches = NULL;
+  pthread_mutex_destroy(&pool->modify_caches);
+  return;
+}
+
+/*
+  Reports how many slabs the pool has allocated and how many tasks 
+they hold in total. These only grow when more tasks are in flight 
+than ever before.
+*/
+void pool_allocator_stats(struct thread_pool* pool, unsigned long* slabs, unsigned long* tasks){
+
+  if(pool == NULL){
+    printf("ERROR: Parameter is not a valid thread_pool\n");
+    return;
+  }
+
+  if(slabs != NULL){
+    (*slabs) = atomic_load_explicit(&pool->slabs_allocated, memory_order_relaxed);
+  }
+  if(tasks != NULL){
+    (*tasks) = atomic_load_explicit(&pool->tasks_allocated, memory_order_relaxed);
+  }
   return;
 }
 
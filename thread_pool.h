@@ -1,11 +1,19 @@
 #ifndef POOL_FUNCTIONS
 #define POOL_FUNCTIONS
 
+#include <stddef.h>
+#include <stdint.h>
+
 struct thread_pool;
+struct task;
+struct task_group;
+struct task_graph;
+struct numa_pool;
 
-/*Creates a thread pool with number_of_threads in it. Defaults to
-FIFO (first in, first out) for task priority. This can be changed
-with the set_priority function.
+/*Creates a thread pool with number_of_threads in it. 'mode' chooses
+how waiting tasks are stored, one of the options listed in queues.h.
+The heap modes order tasks with 'function', or by the integer priority
+of each task if it is NULL.
  */
 struct thread_pool* create_pool(int number_threads, int mode, int (*function)(const void* p1, const void* p2));
 
@@ -15,6 +23,23 @@ struct thread_pool* create_pool(int number_threads, int mode, int (*function)(co
 void add_threads(int number_to_add, struct thread_pool* pool);
 
 
+/*Removes threads from a thread pool. Each thread leaves once it is 
+done with its current task, without waiting for the queue to empty, 
+and this returns without waiting for them.
+*/
+void remove_threads(int number_to_remove, struct thread_pool* pool);
+
+
+/*Lets the pool size itself to its load. While no thread is idle and 
+the tasks not yet finished pile up, threads are added up to 
+'max_threads'. A thread that has been idle for 'keep_alive_ms' 
+milliseconds leaves the pool as long as more than 'min_threads' 
+remain. A max_threads of 0 never adds threads and a keep_alive_ms of 0
+never removes them.
+*/
+void pool_set_autoscale(struct thread_pool* pool, int min_threads, int max_threads, long keep_alive_ms);
+
+
 /*Add a task to the queue. The task consists of two parts, the
 function and the argument. The function must have declaration of the
 form: 
@@ -30,6 +55,259 @@ back for use in the function.
 void add_task(struct thread_pool* pool, void (*function)(void* arg), void* arg);
 
 
+/*Same as add_task except the task carries an integer priority. Mode 10
+(8-ary Heap), and modes 1, 2, 3, 9 and 12 when the pool was created without
+a comparison function, run tasks with the largest priority first.
+Tasks added any other way have priority 0.
+*/
+void add_task_with_priority(struct thread_pool* pool, void (*function)(void* arg), void* arg, int64_t priority);
+
+
+/*Add 'n' tasks to the queue at once. Task i runs functions[i] with 
+args[i]. This is much cheaper than calling add_task 'n' times: the 
+pool is locked once, the heaps are built from the whole batch instead
+of one task at a time, and only as many idle threads are woken as 
+there are new tasks.
+*/
+void add_tasks(struct thread_pool* pool, void (*functions[])(void* arg), void* args[], int n);
+
+
+/*Same as add_tasks except every task runs 'function'. Task i is given
+args[i].
+*/
+void add_tasks_one_function(struct thread_pool* pool, void (*function)(void* arg), void* args[], int n);
+
+
+/*Adds a task whose function returns a value and gives back a handle to
+it. The handle can be waited on with task_wait (blocks and returns the
+result), task_try_wait (returns 1 if the task has run), or 
+task_wait_timeout (returns 0 if 'milliseconds' pass first). task_result
+returns the result without waiting, or NULL if the task has not run.
+task_then attaches one function that is called with the result once
+the task has run. Every handle must be given back with task_release,
+before the pool is destroyed. Returns NULL if the task could not be 
+added.
+*/
+struct task* add_task_future(struct thread_pool* pool, void* (*function)(void* arg), void* arg);
+void* task_wait(struct task* handle);
+int task_try_wait(struct task* handle);
+int task_wait_timeout(struct task* handle, long milliseconds);
+void* task_result(struct task* handle);
+void task_then(struct task* handle, void (*function)(void* result, void* arg), void* arg);
+void task_release(struct task* handle);
+
+
+/*Same as add_task_with_priority except a handle to the task is given
+back, which is waited on and released like the handles of 
+add_task_future. While the task is still queued pool_update_priority
+gives it a new priority and moves it to its new place in the heap or 
+bucket queue: up or down in the Binary Heaps and the Binomial Heaps,
+and by cutting it or its children to the root list in the Fibonacci 
+Heap. It returns 1 if the task was still queued and 0 if it had 
+already been taken. The lock-free modes (6, 7 and 8) do not support 
+it.
+*/
+struct task* add_task_with_handle(struct thread_pool* pool, void (*function)(void* arg), void* arg, int64_t priority);
+int pool_update_priority(struct thread_pool* pool, struct task* handle, int64_t priority);
+
+
+/*Withdraws the task of a handle from add_task_future or 
+add_task_with_handle if no thread has started it, and returns 1. 
+Returns 0 if the task already started or was cancelled before. A 
+cancelled task counts as done: waiting on it returns NULL at once, its
+continuation is never called, and task_cancelled returns 1. The locked
+modes take the task out of the queue, so it is freed once the handle is
+released. The lock-free modes leave it in place and the thread that 
+reaches it frees it without running it.
+*/
+int pool_cancel(struct thread_pool* pool, struct task* handle);
+int task_cancelled(struct task* handle);
+
+
+/*A task group counts the tasks added to it with add_task_to_group that
+have not finished running. task_group_wait blocks until all of them 
+have run; the threads of the pool keep running and the group can be 
+used again. A thread of the pool that waits on a group runs queued 
+tasks in the meantime. pool_wait_idle does the same for every task 
+added to the pool and must not be called from a task.
+*/
+struct task_group* create_task_group(struct thread_pool* pool);
+void add_task_to_group(struct task_group* group, void (*function)(void* arg), void* arg);
+void task_group_wait(struct task_group* group);
+void destroy_task_group(struct task_group* group);
+void pool_wait_idle(struct thread_pool* pool);
+
+
+/*pool_spawn adds a task as a child of the task that calls it and 
+pool_sync waits for the children of the calling task. A thread of the
+pool runs queued tasks instead of blocking in pool_sync, so recursive
+tasks never leave every thread waiting. A task that returns without 
+calling pool_sync waits for its children before it counts as finished.
+Called outside of a task they apply to the children of the calling 
+thread.
+*/
+void pool_spawn(struct thread_pool* pool, void (*function)(void* arg), void* arg);
+void pool_sync(struct thread_pool* pool);
+
+
+/*A task graph holds tasks ('nodes') and edges between them. The node 
+'to' of an edge only runs after the node 'from' has finished. 
+task_graph_add_node returns the id of the new node, or -1 on failure.
+task_graph_submit starts the graph and task_graph_wait blocks until 
+every node has run. A graph can be submitted again once it has been 
+waited on, without adding its nodes and edges again. It must not 
+contain a cycle.
+*/
+struct task_graph* create_task_graph(struct thread_pool* pool);
+int task_graph_add_node(struct task_graph* graph, void (*function)(void* arg), void* arg);
+void task_graph_add_edge(struct task_graph* graph, int from, int to);
+void task_graph_submit(struct task_graph* graph);
+void task_graph_wait(struct task_graph* graph);
+void destroy_task_graph(struct task_graph* graph);
+
+
+/*Runs body(b, e, ctx) over chunks [b, e) that together cover [begin,
+end), each at most 'grain' iterations long, using the threads of the 
+pool and the calling thread. Returns once every iteration has run. If
+'grain' is 0 or less it is chosen by timing the first few iterations.
+*/
+void pool_parallel_for(struct thread_pool* pool, long begin, long end, long grain, void (*body)(long begin, long end, void* ctx), void* ctx);
+
+
+/*Same as pool_parallel_for but computes a result of 'size' bytes. On 
+entry 'result' holds the identity value (0 for a sum). Every thread 
+taking part adds its chunks into a private copy of it with 
+body(b, e, partial, ctx), and the copies are combined into 'result' 
+with combine(into, from, ctx). pool_map_reduce instead calls 
+map(i, value, ctx) for each iteration and combines each value into the
+partial result. Which chunks go into which copy, and the order the 
+copies are combined in, change from run to run, so 'combine' must be 
+associative and commutative. Floating point results may differ in the 
+last bits between runs.
+*/
+void pool_parallel_reduce(struct thread_pool* pool, long begin, long end, long grain, void* result, size_t size, void (*body)(long begin, long end, void* partial, void* ctx), void (*combine)(void* into, const void* from, void* ctx), void* ctx);
+void pool_map_reduce(struct thread_pool* pool, long begin, long end, long grain, void* result, size_t size, void (*map)(long i, void* value, void* ctx), void (*combine)(void* into, const void* from, void* ctx), void* ctx);
+
+
+/*Tasks are stored in memory owned by the pool and reused once they
+have run, so adding tasks does not call malloc once the pool has 
+warmed up. pool_allocator_stats reports how many blocks of tasks
+('slabs') the pool has allocated so far and how many tasks they hold
+in total. Either pointer may be NULL.
+*/
+void pool_allocator_stats(struct thread_pool* pool, unsigned long* slabs, unsigned long* tasks);
+
+
+/*Sets what a thread does when it runs out of work. With policy 1, the
+default, it sleeps until a task is added, which costs a wake up and a
+context switch when work arrives in bursts. With policy 2 it first 
+keeps checking the queue for a while, then yields, and only then 
+sleeps. How long it checks grows when this finds work and shrinks when
+it does not, so a quiet pool does not burn CPU. Policy 3 never sleeps,
+for pools where latency matters more than the cores it keeps busy.
+pool_idle_stats reports how often policy 2 found a task before 
+sleeping ('hits') and how often it did not ('misses').
+*/
+void pool_set_idle_policy(struct thread_pool* pool, int policy);
+void pool_idle_stats(struct thread_pool* pool, unsigned long* hits, unsigned long* misses);
+
+
+/*What a pool, or one of its threads, has done since it was created.
+Times are in nanoseconds. 'idle_ns' is the time a thread spent 
+between tasks, 'lock_wait_ns' the time it waited for the pool's lock
+while another thread held it and 'lock_hold_ns' the time it held the
+lock itself. 'max_queue_depth' is the most tasks seen waiting when 
+one was added, which in the lock-free modes counts the ring or the 
+adding thread's own deque. 'threads', 'idle_threads' and 
+'tasks_pending', the tasks added but not finished, are read at the 
+time of the snapshot.
+*/
+struct pool_stats{
+
+  unsigned long tasks_added;
+  unsigned long tasks_run;
+  unsigned long busy_ns;
+  unsigned long idle_ns;
+  unsigned long lock_waits;
+  unsigned long lock_wait_ns;
+  unsigned long lock_hold_ns;
+  unsigned long max_queue_depth;
+  unsigned long spin_hits;
+  unsigned long spin_misses;
+  int threads;
+  int idle_threads;
+  int tasks_pending;
+};
+
+
+/*Fills 'snapshot' with the counters of every thread that has used the
+pool, including threads outside it that added tasks. The counters are
+read without stopping the threads, so each is exact but they may be a 
+moment apart. pool_get_worker_stats fills 'workers' with the counters 
+of up to 'max' of the pool's threads, one each, and returns how many 
+it filled. For a thread 'threads' is 1, 'idle_threads' is 1 if it is
+asleep waiting for work and 'tasks_pending' counts the tasks on its 
+own deque in the work stealing modes. A thread that replaced one 
+removed from the pool carries on from its counters. Compiling with 
+THREAD_POOL_NO_STATS removes the counters, which then read 0.
+*/
+void pool_get_stats(struct thread_pool* pool, struct pool_stats* snapshot);
+int pool_get_worker_stats(struct thread_pool* pool, struct pool_stats* workers, int max);
+
+
+/*Percentiles of a latency histogram in nanoseconds, each the upper
+end of its bucket so within 12.5% above the true value.
+*/
+struct pool_latency{
+
+  unsigned long count;
+  unsigned long p50;
+  unsigned long p90;
+  unsigned long p99;
+  unsigned long p999;
+  unsigned long max;
+};
+
+
+/*Starts recording, for every task, how long it waited between being 
+added and being taken off the queue and how long its function ran. 
+The n ascending priorities in 'bounds' split the tasks into n+1 
+priority classes, up to 8, recorded separately. A task is in the first
+class whose bound is greater than its priority, so with n = 0 every 
+task is in class 0. A negative n stops recording. pool_get_latency 
+gives the percentiles for 'interval' 0, the wait, or 1, the run, of 
+one priority class or of all of them if 'priority_class' is -1. Each
+pool has one queue mode, so comparing modes means comparing pools.
+*/
+void pool_set_latency_classes(struct thread_pool* pool, const int64_t* bounds, int n);
+void pool_get_latency(struct thread_pool* pool, int interval, int priority_class, struct pool_latency* result);
+
+
+/*Pins the threads of the pool to the 'n' CPUs in 'cpus', one CPU for
+each thread in turn. Threads added later are pinned the same way. 
+Only supported on Linux.
+*/
+void pool_set_affinity(struct thread_pool* pool, const int* cpus, int n);
+
+
+/*Creates one pool for each NUMA node, whose threads only run on the 
+CPUs of that node, with 'threads_per_node' threads each or one per CPU
+if it is 0. add_task_on_node adds a task to the pool of 'node', or 
+with a negative node to the node of the calling thread if it belongs 
+to the numa_pool and otherwise to each node in turn. A thread that 
+runs out of work steals from the other nodes, nearest first, before 
+it sleeps, and a task added to a node with no idle thread wakes one 
+of the nearest node that has one. numa_pool_node returns the pool of 
+one node for use with every other function here.
+*/
+struct numa_pool* create_numa_pool(int threads_per_node, int mode, int (*function)(const void* p1, const void* p2));
+void add_task_on_node(struct numa_pool* numa, int node, void (*function)(void* arg), void* arg);
+int numa_pool_nodes(struct numa_pool* numa);
+struct thread_pool* numa_pool_node(struct numa_pool* numa, int node);
+void destroy_numa_pool_when_idle(struct numa_pool* numa);
+void destroy_numa_pool_immediately(struct numa_pool* numa);
+
+
 /*Calling destroy_pool_immediately allow the threads to finish work
 on the their current tasks but does not allow retrieval of another
 task from the queue. Threads are terminated after completion of 